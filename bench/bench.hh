@@ -0,0 +1,210 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "../src/cpu.hh"
+#include "../src/encode.hh"
+
+namespace Bench {
+
+// 关闭 std::cout，避免调试输出淹没被测代码
+inline void silence_stdout() {
+    std::cout.setstate(std::ios::badbit);
+}
+
+// 运行 fn 并返回耗时（秒）
+template <typename F> double time_it(F &&fn) {
+    auto begin = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+inline void report(const char *name, uint64_t insts, double seconds) {
+    std::printf("%-24s %12llu insts %10.3f ms %10.2f MIPS\n", name,
+                static_cast<unsigned long long>(insts), seconds * 1e3,
+                static_cast<double>(insts) / seconds / 1e6);
+}
+
+// 典型的整数循环：循环体 8 条指令，外加 3 条初始化指令，结尾的 0 是非法指令用于停机
+struct Workload {
+    std::vector<uint8_t> code;
+    uint64_t insts;
+};
+
+// 循环次数用 lui+addi 装入，低12位按有符号数处理，去掉第11位使它不触发进位。
+// 下面的工作负载都先这样调整 iterations，insts 按调整后的次数计算
+inline uint32_t no_carry(uint32_t iterations) {
+    return iterations & ~0x800u;
+}
+
+inline Workload loop_workload(uint32_t iterations) {
+    using namespace Rv;
+    iterations = no_carry(iterations);
+    std::vector<uint32_t> prog = {
+        lui(5, static_cast<int32_t>(iterations >> 12)),
+        addi(5, 5, static_cast<int32_t>(iterations & 0xfff)),
+        lui(11, 1), // 数据放在代码之外的页，避免写入使预解码缓存失效
+        // loop:
+        addi(6, 6, 1),
+        add(7, 7, 6),
+        xor_(8, 8, 7),
+        slli(9, 8, 1),
+        sub(10, 9, 6),
+        sd(10, 11, 0),
+        addi(5, 5, -1),
+        bne(5, 0, -28),
+        0,
+    };
+    return {to_bytes(prog), 3 + uint64_t{iterations} * 8};
+}
+
+// 含有可融合指令对的循环：常量加载、位段提取、PC 相对读取、函数调用和比较后分支，
+// 循环体与被调用的函数共 14 条指令，外加 2 条初始化指令
+inline Workload fusion_workload(uint32_t iterations) {
+    using namespace Rv;
+    iterations = no_carry(iterations);
+    std::vector<uint32_t> prog = {
+        lui(5, static_cast<int32_t>(iterations >> 12)),
+        addi(5, 5, static_cast<int32_t>(iterations & 0xfff)),
+        // loop:
+        lui(6, 0x12345),
+        addi(6, 6, 0x678),
+        slli(7, 6, 48),
+        srli(7, 7, 56),
+        auipc(8, 2),
+        ld(9, 8, -24), // 读取 0x2000
+        add(10, 10, 9),
+        auipc(1, 0),
+        jalr(1, 1, 24), // 调用 func
+        addi(5, 5, -1),
+        slt(11, 0, 5),
+        bne(11, 0, -44),
+        0,
+        // func:
+        add(12, 12, 7),
+        jalr(0, 1, 0),
+    };
+    return {to_bytes(prog), 2 + uint64_t{iterations} * 14};
+}
+
+// bench_aot 离线翻译的 call_workload 迭代次数，翻译时就固定在镜像里
+constexpr uint32_t AOT_ITERATIONS = 1000;
+
+// 仿照编译器 -O2 生成的调用循环：参数用 li/mv 传递，被调用函数里有 mv、li 和对齐用的 nop。
+// 每次迭代 12 条指令，外加 3 条初始化指令
+inline Workload call_workload(uint32_t iterations) {
+    using namespace Rv;
+    iterations = no_carry(iterations);
+    std::vector<uint32_t> prog = {
+        lui(8, static_cast<int32_t>(iterations >> 12)), // li s0, iterations
+        addi(8, 8, static_cast<int32_t>(iterations & 0xfff)),
+        addi(9, 0, 0), // li s1, 0
+        // loop:
+        addi(10, 9, 0), // mv a0, s1
+        addi(11, 0, 3), // li a1, 3
+        jal(1, 20),     // call f
+        addi(9, 10, 0), // mv s1, a0
+        addi(8, 8, -1),
+        bne(8, 0, -20),
+        0,
+        // f:
+        addi(15, 10, 0), // mv a5, a0
+        add(10, 15, 11),
+        addi(14, 0, 1), // li a4, 1
+        xor_(10, 10, 14),
+        addi(0, 0, 0), // nop
+        jalr(0, 1, 0), // ret
+    };
+    return {to_bytes(prog), 3 + uint64_t{iterations} * 12};
+}
+
+// 仿照 CoreMark 的 crcu8/crc16：按位计算 CRC-16（多项式 0xA001），
+// 按 -O2 常见的写法用掩码代替条件跳转，内层循环是一个基本块。
+// 数据取自程序自己的前 64 字节，重复 iterations 轮
+inline Workload crc_workload(uint32_t iterations) {
+    using namespace Rv;
+    iterations = no_carry(iterations);
+    std::vector<uint32_t> prog = {
+        lui(5, static_cast<int32_t>(iterations >> 12)),
+        addi(5, 5, static_cast<int32_t>(iterations & 0xfff)),
+        lui(16, 0xa), // x16 = 0xa001
+        addi(16, 16, 1),
+        lui(12, 0x10), // crc = 0xffff
+        addi(12, 12, -1),
+        // round:
+        addi(10, 0, 0),  // 数据指针
+        addi(11, 0, 64), // 长度
+        // byte:
+        lbu(13, 10, 0),
+        addi(14, 0, 8),
+        // bit:
+        xor_(15, 12, 13),
+        andi(15, 15, 1),
+        sub(15, 0, 15), // 最低位为1时掩码全1
+        and_(15, 15, 16),
+        srli(12, 12, 1),
+        xor_(12, 12, 15),
+        srli(13, 13, 1),
+        addi(14, 14, -1),
+        bne(14, 0, -32),
+        addi(10, 10, 1),
+        addi(11, 11, -1),
+        bne(11, 0, -52),
+        addi(5, 5, -1),
+        bne(5, 0, -68),
+        0,
+    };
+    // 每字节 8 次 9 条指令的内层循环加 5 条，每轮再加 4 条
+    return {to_bytes(prog), 6 + uint64_t{iterations} * (64 * (8 * 9 + 5) + 4)};
+}
+
+// 带名字的工作负载和 Cpu 配置，供 run_configs 使用
+struct Case {
+    const char *name;
+    Workload workload;
+};
+
+struct Config {
+    const char *name;
+    std::function<void(Cpu &)> setup;
+};
+
+// 在每个工作负载上依次用各配置新建 Cpu 运行一遍，按 "负载 (配置)" 报告吞吐。
+// 每次运行后调用 after（可以为空）打印额外的统计。结果要与第一个配置相同，
+// 指令数要与工作负载给出的相同，全部一致时返回 true
+inline bool run_configs(
+    const std::vector<Case> &cases, const std::vector<Config> &configs,
+    const std::function<void(const Config &, const Cpu &)> &after = {}) {
+    bool ok = true;
+    for (const auto &[name, workload] : cases) {
+        RegisterFile expected{};
+        for (const Config &config : configs) {
+            Cpu cpu(workload.code);
+            config.setup(cpu);
+            double t = time_it([&] { cpu.run(); });
+
+            char label[64];
+            std::snprintf(label, sizeof(label), "%s (%s)", name, config.name);
+            report(label, workload.insts, t);
+            if (after) {
+                after(config, cpu);
+            }
+            if (&config == &configs.front()) {
+                expected = cpu.regs;
+            }
+            ok = ok && cpu.regs == expected && cpu.instret == workload.insts;
+        }
+    }
+    return ok;
+}
+
+} // namespace Bench
+
+#endif
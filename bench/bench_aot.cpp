@@ -0,0 +1,35 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "../src/aot.hh"
+#include "../src/cpu.hh"
+#include "bench.hh"
+
+// bench_image 生成、crvemu_aot 离线翻译的 call_workload 镜像
+extern const AotImage aot_image;
+
+// 短程序反复冷启动运行：每次都从新的 Cpu 开始，解释器要重新翻译基本块，
+// 即时编译器要重新预热，离线翻译的代码直接执行。只计 run() 的时间，不计创建 Cpu
+int main(int argc, char *argv[]) {
+    int runs = argc > 1 ? std::atoi(argv[1]) : 20;
+    Bench::silence_stdout();
+
+    const auto workload = Bench::call_workload(Bench::AOT_ITERATIONS);
+    const uint64_t insts = workload.insts * runs;
+    bool ok = true;
+
+    auto measure = [&](const char *name, auto &&setup) {
+        double seconds = 0;
+        for (int i = 0; i < runs; i++) {
+            Cpu cpu(workload.code);
+            setup(cpu);
+            seconds += Bench::time_it([&] { cpu.run(); });
+            ok = ok && cpu.instret == workload.insts;
+        }
+        Bench::report(name, insts, seconds);
+    };
+    measure("block (cold)", [](Cpu &) {});
+    measure("jit (cold)", [](Cpu &cpu) { cpu.engine = Engine::Jit; });
+    measure("aot", [&](Cpu &cpu) { ok = ok && cpu.attach(aot_image); });
+    return ok ? 0 : 1;
+}
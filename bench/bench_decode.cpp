@@ -0,0 +1,93 @@
+#include <cstdlib>
+#include <random>
+
+#include "../src/cpu.hh"
+#include "bench.hh"
+#include "decode_switch.hh"
+
+// 随机生成的指令字：opcode 取自已实现的指令，其余位随机，覆盖各种 funct3/funct7 组合
+static std::vector<uint32_t> random_words(size_t count) {
+    const uint32_t opcodes[] = {0x37, 0x17, 0x6f, 0x67, 0x63,
+                                0x03, 0x23, 0x13, 0x33, 0x1b, 0x3b};
+    std::mt19937 rng(1);
+    std::vector<uint32_t> words(count);
+    for (auto &word : words) {
+        word = (rng() & ~0x7fu) | opcodes[rng() % std::size(opcodes)];
+    }
+    return words;
+}
+
+// 只计时解码本身，把结果折叠起来防止被优化掉
+template <typename F>
+static uint64_t decode_all(const std::vector<uint32_t> &words, F &&decoder) {
+    uint64_t sum = 0;
+    for (uint32_t word : words) {
+        DecodedInst d = decoder(word);
+        sum += static_cast<uint64_t>(d.op);
+        if (d.op != Op::Illegal) {
+            sum += d.imm;
+        }
+    }
+    return sum;
+}
+
+// 对比嵌套 switch 与表格驱动解码器，以及逐条解码（fetch + execute(uint32_t)）与预解码缓存（step）的吞吐
+int main(int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    auto workload = Bench::loop_workload(iterations);
+    Bench::silence_stdout();
+
+    Cpu base(workload.code);
+    double t0 = Bench::time_it([&] {
+        while (true) {
+            auto inst = base.fetch();
+            if (!inst.has_value()) {
+                break;
+            }
+            auto next_pc = base.execute(inst.value());
+            if (!next_pc.has_value()) {
+                break;
+            }
+            base.pc = next_pc.value();
+        }
+    });
+
+    Cpu cached(workload.code);
+    double t1 = Bench::time_it([&] {
+        while (true) {
+            auto next_pc = cached.step();
+            if (!next_pc.has_value()) {
+                break;
+            }
+            cached.pc = next_pc.value();
+        }
+    });
+
+    auto words = random_words(1 << 16);
+    for (uint32_t word : words) {
+        DecodedInst a = Bench::decode_switch(word);
+        DecodedInst b = decode(word);
+        // 旧解码器在非法指令上也会填写立即数，只比较合法指令
+        if (a.op != b.op || (a.op != Op::Illegal && a.imm != b.imm)) {
+            return 1;
+        }
+    }
+    uint64_t rounds = iterations / 4096 + 1;
+    uint64_t sums[2] = {};
+    double t_switch = Bench::time_it([&] {
+        for (uint64_t i = 0; i < rounds; i++) {
+            sums[0] += decode_all(words, Bench::decode_switch);
+        }
+    });
+    double t_table = Bench::time_it([&] {
+        for (uint64_t i = 0; i < rounds; i++) {
+            sums[1] += decode_all(words, decode);
+        }
+    });
+
+    Bench::report("decode (switch)", rounds * words.size(), t_switch);
+    Bench::report("decode (table)", rounds * words.size(), t_table);
+    Bench::report("decode every step", workload.insts, t0);
+    Bench::report("predecoded cache", workload.insts, t1);
+    return base.regs[10] == cached.regs[10] && sums[0] == sums[1] ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#include <cstdlib>
+
+#include "../src/cpu.hh"
+#include "bench.hh"
+
+// 对比各执行引擎在同一个整数循环上的吞吐
+int main(int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    auto workload = Bench::loop_workload(iterations);
+    Bench::silence_stdout();
+
+    Cpu stepped(workload.code);
+    double t_step = Bench::time_it([&] {
+        while (true) {
+            auto next_pc = stepped.step();
+            if (!next_pc.has_value()) {
+                break;
+            }
+            stepped.pc = next_pc.value();
+        }
+    });
+    Bench::report("step", workload.insts, t_step);
+
+    Cpu blocked(workload.code);
+    double t_block = Bench::time_it([&] { blocked.run(); });
+    Bench::report("block", workload.insts, t_block);
+
+#if defined(CRVEMU_THREADED_DISPATCH)
+    Cpu threaded(workload.code);
+    threaded.engine = Engine::Threaded;
+    double t_threaded = Bench::time_it([&] { threaded.run(); });
+    Bench::report("threaded", workload.insts, t_threaded);
+    if (threaded.regs != blocked.regs) {
+        return 1;
+    }
+#endif
+
+    Cpu tailcall(workload.code);
+    tailcall.engine = Engine::TailCall;
+    double t_tailcall = Bench::time_it([&] { tailcall.run(); });
+    Bench::report("tailcall", workload.insts, t_tailcall);
+    if (tailcall.regs != blocked.regs) {
+        return 1;
+    }
+
+    Cpu jitted(workload.code);
+    jitted.engine = Engine::Jit;
+    double t_jit = Bench::time_it([&] { jitted.run(); });
+    Bench::report("jit", workload.insts, t_jit);
+
+    return stepped.regs == blocked.regs && blocked.regs == jitted.regs ? 0 : 1;
+}
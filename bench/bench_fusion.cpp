@@ -0,0 +1,45 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "../src/cpu.hh"
+#include "bench.hh"
+
+// 对比各解释器核心开启/关闭超级指令融合时的吞吐
+int main(int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    Bench::silence_stdout();
+
+    const bool ok = Bench::run_configs(
+        {{"fusion", Bench::fusion_workload(iterations)}},
+        {
+            {"block", [](Cpu &cpu) { cpu.fusion = false; }},
+            {"block+fusion", [](Cpu &) {}},
+#if defined(CRVEMU_THREADED_DISPATCH)
+            {"threaded",
+             [](Cpu &cpu) {
+                 cpu.engine = Engine::Threaded;
+                 cpu.fusion = false;
+             }},
+            {"threaded+fusion",
+             [](Cpu &cpu) { cpu.engine = Engine::Threaded; }},
+#endif
+            {"tailcall",
+             [](Cpu &cpu) {
+                 cpu.engine = Engine::TailCall;
+                 cpu.fusion = false;
+             }},
+            {"tailcall+fusion",
+             [](Cpu &cpu) { cpu.engine = Engine::TailCall; }},
+        },
+        [](const Bench::Config &config, const Cpu &cpu) {
+            if (config.name != std::string_view("block+fusion")) {
+                return;
+            }
+            for (size_t i = 0; i < FusionStats::KINDS; i++) {
+                std::printf("  %-12s %12llu executed\n", FusionStats::name(i),
+                            static_cast<unsigned long long>(
+                                cpu.fusion_stats.executed[i]));
+            }
+        });
+    return ok ? 0 : 1;
+}
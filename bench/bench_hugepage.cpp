@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "../src/cpu.hh"
+#include "../src/encode.hh"
+#include "bench.hh"
+
+namespace {
+
+// 链表放在 16MiB 开始的 span 字节中，每个节点占一条 64 字节的缓存行
+constexpr uint64_t LIST_BASE = DRAM_BASE + (16 << 20);
+constexpr uint64_t NODE_SIZE = 64;
+
+// 沿链表做 iterations 次依赖的读取：每次 ld 的地址是上一次读出的值。
+// 循环体 3 条指令，外加 2 条初始化指令
+Bench::Workload chase_workload(uint32_t iterations) {
+    using namespace Rv;
+    std::vector<uint32_t> prog = {
+        lui(5, static_cast<int32_t>(iterations >> 12)),
+        lui(6, static_cast<int32_t>(LIST_BASE >> 12)),
+        // loop:
+        ld(6, 6, 0),
+        addi(5, 5, -1),
+        bne(5, 0, -8),
+        0,
+    };
+    return {to_bytes(prog), 2 + uint64_t{iterations} * 3};
+}
+
+// 把节点随机串成一个环（Sattolo 洗牌），相邻两次读取几乎总落在不同的页上
+void build_list(Cpu &cpu, uint64_t span) {
+    const uint64_t nodes = span / NODE_SIZE;
+    std::vector<uint64_t> order(nodes);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 rng(1);
+    for (uint64_t i = nodes - 1; i > 0; i--) {
+        std::swap(order[i], order[rng() % i]);
+    }
+    uint8_t *ram = cpu.bus.ram();
+    for (uint64_t i = 0; i < nodes; i++) {
+        const uint64_t offset = LIST_BASE - DRAM_BASE + i * NODE_SIZE;
+        host_store<uint64_t>(ram + offset, LIST_BASE + order[i] * NODE_SIZE);
+        cpu.bus.touch(offset, 8);
+    }
+}
+
+} // namespace
+
+// 随机访存的客户机程序在普通页、透明大页和 hugetlbfs 上的对比：
+// 在 span MiB 的链表上追指针，宿主机 TLB 缺失决定了速度。
+// 用即时编译器执行，使访存成为瓶颈
+int main(int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 20'000'000;
+    uint64_t span = (argc > 2 ? std::atoll(argv[2]) : 64) << 20;
+    // 循环次数只用 lui 装入，按 4096 取整
+    iterations = std::max<uint32_t>(iterations >> 12, 1) << 12;
+    span = std::min<uint64_t>(span, DRAM_SIZE - (LIST_BASE - DRAM_BASE));
+
+    const Bench::Workload workload = chase_workload(iterations);
+    const struct {
+        const char *name;
+        HugePages huge;
+    } configs[] = {
+        {"4KiB pages", HugePages::Off},
+        {"transparent huge pages", HugePages::Transparent},
+        {"hugetlbfs", HugePages::HugeTlb},
+    };
+    const char *names[] = {"off", "thp", "hugetlb"};
+    uint64_t expect = 0;
+    for (const auto &config : configs) {
+        Cpu cpu(workload.code, config.huge);
+        cpu.engine = Engine::Jit;
+        build_list(cpu, span);
+        double seconds = Bench::time_it([&] { cpu.run(); });
+        Bench::report(config.name, cpu.instret, seconds);
+        std::printf("%-24s got %s, %llu MiB in huge pages, %.2f ns/load\n", "",
+                    names[static_cast<int>(cpu.bus.huge_pages())],
+                    static_cast<unsigned long long>(
+                        cpu.bus.huge_page_bytes() >> 20),
+                    seconds / iterations * 1e9);
+        // 各配置走过的链表相同，最后停在同一个节点
+        if (expect == 0) {
+            expect = cpu.regs[6];
+        }
+        if (cpu.instret != workload.insts || cpu.regs[6] != expect) {
+            std::printf("unexpected result\n");
+            return 1;
+        }
+    }
+    return 0;
+}
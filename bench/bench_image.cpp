@@ -0,0 +1,21 @@
+#include <cstdio>
+
+#include "bench.hh"
+
+// 把基准测试的工作负载写成平面二进制镜像，供 crvemu_aot 离线翻译
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::printf("Usage:\n- ./bench_image <output.bin>\n");
+        return 1;
+    }
+    const auto workload = Bench::call_workload(Bench::AOT_ITERATIONS);
+    std::FILE *out = std::fopen(argv[1], "wb");
+    if (out == nullptr ||
+        std::fwrite(workload.code.data(), 1, workload.code.size(), out) !=
+            workload.code.size()) {
+        std::perror(argv[1]);
+        return 1;
+    }
+    std::fclose(out);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "../src/cpu.hh"
+#include "../src/dram.hh"
+#include "bench.hh"
+
+namespace {
+
+void report_ops(const char *name, uint64_t ops, double seconds) {
+    std::printf("%-28s %12llu ops %10.3f ms %8.2f ns/op\n", name,
+                static_cast<unsigned long long>(ops), seconds * 1e3,
+                seconds / static_cast<double>(ops) * 1e9);
+}
+
+// 改为 memcpy 之前的做法：按位数逐字节拼出数值
+uint64_t load_bytewise(const uint8_t *ram, uint64_t addr, uint64_t size) {
+    uint64_t nbytes = size / 8;
+    uint64_t index = addr - DRAM_BASE;
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < nbytes; i++) {
+        value |= static_cast<uint64_t>(ram[index + i]) << (i * 8);
+    }
+    return value;
+}
+
+void store_bytewise(uint8_t *ram, uint64_t addr, uint64_t size,
+                    uint64_t value) {
+    uint64_t nbytes = size / 8;
+    uint64_t index = addr - DRAM_BASE;
+    for (uint64_t i = 0; i < nbytes; i++) {
+        ram[index + i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+} // namespace
+
+// DRAM 访存路径的微基准：逐字节拼接（旧做法）、按运行时位数转发和按类型的 memcpy，
+// 以及 CPU 经过总线与直接用 RAM 宿主机指针访问的对比、CPU 写入数据页（只标记脏页）的开销
+// 和扫描脏页的开销。
+// 在 1MiB 范围内按随机的对齐地址读写 8 位和 64 位数据
+int main(int argc, char *argv[]) {
+    uint64_t ops = argc > 1 ? std::atoll(argv[1]) : 20'000'000;
+
+    Dram dram(std::vector<uint8_t>(1 << 20, 0x5a));
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> addrs(4096);
+    for (uint64_t &a : addrs) {
+        a = DRAM_BASE + (rng() % (1 << 20)) / 8 * 8;
+    }
+    const size_t mask = addrs.size() - 1;
+    uint64_t sum = 0;
+
+    auto measure = [&](const char *name, auto &&op) {
+        double seconds = Bench::time_it([&] {
+            for (uint64_t i = 0; i < ops; i++) {
+                op(addrs[i & mask], i);
+            }
+        });
+        report_ops(name, ops, seconds);
+    };
+
+    measure("load64 bytewise (before)", [&](uint64_t a, uint64_t) {
+        sum += load_bytewise(dram.data(), a, 64);
+    });
+    measure("load64 runtime size", [&](uint64_t a, uint64_t) {
+        sum += dram.load(a, 64).value();
+    });
+    measure("load64 template", [&](uint64_t a, uint64_t) {
+        sum += dram.load<uint64_t>(a).value();
+    });
+    measure("load8 bytewise (before)", [&](uint64_t a, uint64_t) {
+        sum += load_bytewise(dram.data(), a, 8);
+    });
+    measure("load8 template", [&](uint64_t a, uint64_t) {
+        sum += dram.load<uint8_t>(a).value();
+    });
+    measure("store64 bytewise (before)", [&](uint64_t a, uint64_t i) {
+        store_bytewise(dram.data(), a, 64, i);
+    });
+    measure("store64 runtime size", [&](uint64_t a, uint64_t i) {
+        sum += dram.store(a, 64, i).has_value();
+    });
+    measure("store64 template", [&](uint64_t a, uint64_t i) {
+        sum += dram.store<uint64_t>(a, i).has_value();
+    });
+
+    Cpu cpu(std::vector<uint8_t>(1 << 20, 0x5a));
+    measure("load64 via bus", [&](uint64_t a, uint64_t) {
+        sum += cpu.bus.load<uint64_t>(a).value();
+    });
+    measure("load64 cpu (host pointer)", [&](uint64_t a, uint64_t) {
+        sum += cpu.load<uint64_t>(a).value();
+    });
+    measure("store64 cpu (data pages)", [&](uint64_t a, uint64_t i) {
+        sum += cpu.store<uint64_t>(a, i);
+    });
+
+    // 扫描并清除 128MiB DRAM 的脏页记录，每轮之间弄脏一页
+    const uint64_t scans = 10'000;
+    double seconds = Bench::time_it([&] {
+        for (uint64_t i = 0; i < scans; i++) {
+            sum += cpu.bus.dirty_pages().size();
+            cpu.bus.clear_dirty();
+            cpu.store<uint64_t>(addrs[i & mask], i);
+        }
+    });
+    report_ops("dirty_pages + clear_dirty", scans, seconds);
+
+    // 防止读出的数据被优化掉
+    std::printf("checksum %llu\n", static_cast<unsigned long long>(sum));
+    return 0;
+}
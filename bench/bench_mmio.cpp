@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../src/cpu.hh"
+#include "../src/encode.hh"
+#include "bench.hh"
+
+namespace {
+
+// 设备窗口从 0x1000_0000 开始，每个窗口一页，相邻窗口相隔 1MiB
+constexpr uint64_t MMIO_BASE = 0x1000'0000;
+constexpr uint64_t WINDOW_STRIDE = 0x10'0000;
+
+// 读出的值是偏移加上最近写入的值，让每次访问都有可观察的结果
+class Register : public Device {
+public:
+    std::optional<uint64_t> load(uint64_t offset, uint64_t) override {
+        return offset + value;
+    }
+    bool store(uint64_t, uint64_t, uint64_t v) override {
+        value = v;
+        return true;
+    }
+
+private:
+    uint64_t value = 0;
+};
+
+MachineConfig machine_with(int devices) {
+    MachineConfig machine;
+    machine.ram_base = 0x8000'0000;
+    machine.ram_size = 1 << 20;
+    for (int i = 0; i < devices; i++) {
+        machine.devices.push_back({"dev" + std::to_string(i),
+                                   MMIO_BASE + i * WINDOW_STRIDE,
+                                   MachineConfig::PAGE_SIZE});
+    }
+    return machine;
+}
+
+// 对照：按注册顺序逐个比较窗口范围
+struct Range {
+    uint64_t base;
+    uint64_t size;
+    Device *device;
+};
+
+std::optional<uint64_t> chain_load(const std::vector<Range> &ranges,
+                                   uint64_t addr) {
+    for (const Range &r : ranges) {
+        if (addr - r.base < r.size) {
+            return r.device->load(addr - r.base, 32);
+        }
+    }
+    return std::nullopt;
+}
+
+// 客户机程序：向 MMIO_BASE 处的设备写入后读回，循环体 4 条指令，外加 2 条初始化指令
+Bench::Workload mmio_workload(uint32_t iterations) {
+    using namespace Rv;
+    std::vector<uint32_t> prog = {
+        lui(5, static_cast<int32_t>(iterations >> 12)),
+        lui(6, static_cast<int32_t>(MMIO_BASE >> 12)),
+        // loop:
+        sw(5, 6, 0),
+        lw(7, 6, 4),
+        addi(5, 5, -1),
+        bne(5, 0, -12),
+        0,
+    };
+    return {to_bytes(prog), 2 + uint64_t{iterations} * 4};
+}
+
+} // namespace
+
+// MMIO 分派的延迟：总线查两级页表与逐个比较窗口范围的对比，设备数量从 1 增加到 256。
+// 访问轮流落在各个设备上，比较范围的平均代价随设备数量线性增长，查表的代价不变。
+// 最后用基本块解释器执行读写设备寄存器的客户机程序
+int main(int argc, char *argv[]) {
+    const uint64_t accesses = argc > 1 ? std::atoll(argv[1]) : 20'000'000;
+    uint64_t checksum = 0;
+
+    for (int devices : {1, 16, 256}) {
+        Bus bus(machine_with(devices), std::vector<uint8_t>{});
+        std::vector<Range> ranges;
+        std::vector<uint64_t> addrs;
+        for (int i = 0; i < devices; i++) {
+            auto device = std::make_shared<Register>();
+            const uint64_t base = MMIO_BASE + i * WINDOW_STRIDE;
+            bus.attach("dev" + std::to_string(i), device);
+            ranges.push_back({base, MachineConfig::PAGE_SIZE, device.get()});
+        }
+        // 打乱访问顺序，避免分支预测记住比较链在哪里结束
+        for (uint64_t i = 0; i < 4096; i++) {
+            const uint64_t device = (i * 2654435761u >> 7) % devices;
+            addrs.push_back(MMIO_BASE + device * WINDOW_STRIDE + (i & 63) * 4);
+        }
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "page table, %d dev", devices);
+        double seconds = Bench::time_it([&] {
+            for (uint64_t i = 0; i < accesses; i++) {
+                checksum += bus.load<uint32_t>(addrs[i & 4095]).value();
+            }
+        });
+        std::printf("%-24s %12llu ops %10.3f ms %8.2f ns/op\n", name,
+                    static_cast<unsigned long long>(accesses), seconds * 1e3,
+                    seconds / accesses * 1e9);
+
+        std::snprintf(name, sizeof(name), "range chain, %d dev", devices);
+        seconds = Bench::time_it([&] {
+            for (uint64_t i = 0; i < accesses; i++) {
+                checksum += chain_load(ranges, addrs[i & 4095]).value();
+            }
+        });
+        std::printf("%-24s %12llu ops %10.3f ms %8.2f ns/op\n", name,
+                    static_cast<unsigned long long>(accesses), seconds * 1e3,
+                    seconds / accesses * 1e9);
+    }
+
+    // 循环次数只用 lui 装入，按 4096 取整
+    const uint32_t iterations =
+        std::max<uint64_t>(accesses / 2 >> 12, 1) << 12;
+    const Bench::Workload workload = mmio_workload(iterations);
+    for (int devices : {1, 256}) {
+        Cpu cpu(Bus{machine_with(devices), workload.code});
+        for (int i = 0; i < devices; i++) {
+            cpu.bus.attach("dev" + std::to_string(i),
+                           std::make_shared<Register>());
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "guest sw+lw, %d dev", devices);
+        double seconds = Bench::time_it([&] { cpu.run(); });
+        Bench::report(name, cpu.instret, seconds);
+        if (cpu.instret != workload.insts || cpu.regs[7] != 1 + 4) {
+            std::printf("unexpected result\n");
+            return 1;
+        }
+    }
+    std::printf("checksum %llu\n", static_cast<unsigned long long>(checksum));
+    return 0;
+}
@@ -0,0 +1,25 @@
+#include <cstdlib>
+
+#include "../src/cpu.hh"
+#include "bench.hh"
+
+// 即时编译时开启/关闭宿主机寄存器分配的吞吐对比，crc 是 CoreMark 风格的位运算内核
+int main(int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    Bench::silence_stdout();
+
+    const bool ok = Bench::run_configs(
+        {
+            {"loop", Bench::loop_workload(iterations)},
+            {"crc", Bench::crc_workload(iterations / 512)},
+        },
+        {
+            {"jit",
+             [](Cpu &cpu) {
+                 cpu.engine = Engine::Jit;
+                 cpu.jit_regalloc = false;
+             }},
+            {"jit+regalloc", [](Cpu &cpu) { cpu.engine = Engine::Jit; }},
+        });
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../src/cpu.hh"
+#include "bench.hh"
+
+namespace {
+
+void report_each(const char *name, int runs, double seconds) {
+    std::printf("%-24s %8d runs %12.1f us/run\n", name, runs,
+                seconds / runs * 1e6);
+}
+
+// 进程当前占用的物理内存（MiB）
+double resident_mib() {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return static_cast<double>(resident * sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+// 同时创建 count 个实例运行同一个大镜像，报告每个实例多占用的物理内存
+template <typename F>
+void report_instances(const char *name, int count, F &&make) {
+    const double before = resident_mib();
+    std::vector<std::unique_ptr<Cpu>> cpus;
+    double seconds = Bench::time_it([&] {
+        for (int i = 0; i < count; i++) {
+            cpus.push_back(make());
+            cpus.back()->run();
+        }
+    });
+    std::printf("%-24s %8d runs %12.1f us/run %8.2f MiB/instance\n", name,
+                count, seconds / count * 1e6,
+                (resident_mib() - before) / count);
+}
+
+} // namespace
+
+// 启动开销：创建 Cpu（映射 DRAM 并复制程序镜像）、创建后执行一个短程序、拷贝 Cpu，
+// 以及与之对比的旧做法——把整个 DRAM 用 std::vector 分配并清零。
+// 然后同时运行多个 4MiB 镜像的实例，对比复制镜像与共享镜像（写时复制）的内存占用。
+// 最后从文件加载 image_mib MiB 的镜像（默认 256MiB，RAM 按镜像放大），
+// 对比读入再复制与直接映射文件
+int main(int argc, char *argv[]) {
+    int runs = argc > 1 ? std::atoi(argv[1]) : 200;
+    const uint64_t image_mib = argc > 2 ? std::atoll(argv[2]) : 256;
+    Bench::silence_stdout();
+
+    const auto workload = Bench::loop_workload(100);
+    bool ok = true;
+
+    double t_create = Bench::time_it([&] {
+        for (int i = 0; i < runs; i++) {
+            Cpu cpu(workload.code);
+            ok = ok && cpu.pc == DRAM_BASE;
+        }
+    });
+    report_each("create", runs, t_create);
+
+    double t_run = Bench::time_it([&] {
+        for (int i = 0; i < runs; i++) {
+            Cpu cpu(workload.code);
+            cpu.run();
+            ok = ok && cpu.instret == workload.insts;
+        }
+    });
+    report_each("create + run", runs, t_run);
+
+    Cpu original(workload.code);
+    original.run();
+    double t_copy = Bench::time_it([&] {
+        for (int i = 0; i < runs; i++) {
+            Cpu copy(original);
+            ok = ok && copy.regs == original.regs;
+        }
+    });
+    report_each("copy", runs, t_copy);
+
+    // 旧做法的开销与 runs 无关，只测几次
+    const int eager_runs = 5;
+    double t_eager = Bench::time_it([&] {
+        for (int i = 0; i < eager_runs; i++) {
+            std::vector<uint8_t> dram(DRAM_SIZE, 0);
+            std::copy(workload.code.begin(), workload.code.end(), dram.begin());
+            ok = ok && dram[0] == workload.code[0];
+        }
+    });
+    report_each("eager vector (before)", eager_runs, t_eager);
+
+    // 短程序后面跟着 4MiB 的数据，程序只写其中一页
+    std::vector<uint8_t> big = workload.code;
+    big.resize(4 << 20, 0x5a);
+    auto image = std::make_shared<GuestImage>(big);
+    const int instances = 50;
+    report_instances("copied image", instances,
+                     [&] { return std::make_unique<Cpu>(big); });
+    report_instances("shared image", instances,
+                     [&] { return std::make_unique<Cpu>(image); });
+    Cpu parent(image);
+    parent.run();
+    report_instances("clone", instances,
+                     [&] { return std::make_unique<Cpu>(parent); });
+
+    // 大镜像写到临时文件里，开头是短程序。先读一遍使文件进入页缓存，只比较加载本身
+    char path[] = "/tmp/crvemu_bench_XXXXXX";
+    const int fd = mkstemp(path);
+    std::vector<uint8_t> file_image = workload.code;
+    file_image.resize(image_mib << 20, 0x5a);
+    ok = ok && fd >= 0 &&
+         write(fd, file_image.data(), file_image.size()) ==
+             static_cast<ssize_t>(file_image.size());
+    close(fd);
+    file_image = {};
+    // 默认的 128MiB RAM 装不下大镜像，按镜像大小配置机器
+    MachineConfig machine;
+    machine.ram_size = std::max<uint64_t>(DRAM_SIZE, image_mib << 20);
+    const int load_runs = 3;
+    std::printf("loading a %llu MiB image:\n",
+                static_cast<unsigned long long>(image_mib));
+    double t_read = Bench::time_it([&] {
+        for (int i = 0; i < load_runs; i++) {
+            std::ifstream file(path, std::ios::binary);
+            std::vector<uint8_t> code(std::istreambuf_iterator<char>(file), {});
+            Cpu cpu(Bus{machine, code});
+            ok = ok && cpu.load(DRAM_BASE, 8) == code[0];
+        }
+    });
+    report_each("read + copy (before)", load_runs, t_read);
+    double t_map = Bench::time_it([&] {
+        for (int i = 0; i < load_runs; i++) {
+            Cpu cpu(Bus{machine, GuestImage::open(path)});
+            ok = ok && cpu.load(DRAM_BASE, 8) == workload.code[0];
+        }
+    });
+    report_each("mmap", load_runs, t_map);
+    // 映射只是推迟了开销：客户机访问每一页时各有一次缺页
+    double t_touch = Bench::time_it([&] {
+        for (int i = 0; i < load_runs; i++) {
+            Cpu cpu(Bus{machine, GuestImage::open(path)});
+            uint64_t sum = 0;
+            for (uint64_t page = 0; page < image_mib << 20; page += 4096) {
+                sum += cpu.bus.ram()[page];
+            }
+            ok = ok && sum != 0;
+        }
+    });
+    report_each("mmap + read every page", load_runs, t_touch);
+    unlink(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "../src/cpu.hh"
+#include "bench.hh"
+
+// 热点探测与轨迹执行层：对比关闭轨迹、只计数不生成轨迹（冷层的计数开销）和默认配置
+int main(int argc, char *argv[]) {
+    uint32_t iterations = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    Bench::silence_stdout();
+
+    const bool ok = Bench::run_configs(
+        {
+            {"loop", Bench::loop_workload(iterations)},
+            {"fusion", Bench::fusion_workload(iterations)},
+            {"call", Bench::call_workload(iterations)},
+        },
+        {
+            {"no tracing", [](Cpu &cpu) { cpu.tracing = false; }},
+            {"counters only",
+             [](Cpu &cpu) { cpu.trace_threshold = ~uint32_t{0}; }},
+            {"traces", [](Cpu &) {}},
+        },
+        [](const Bench::Config &config, const Cpu &cpu) {
+            if (config.name != std::string_view("traces")) {
+                return;
+            }
+            std::printf(
+                "  %llu traces, %llu entered, %llu side exits\n",
+                static_cast<unsigned long long>(cpu.trace_stats.recorded),
+                static_cast<unsigned long long>(cpu.trace_stats.entered),
+                static_cast<unsigned long long>(cpu.trace_stats.exits));
+        });
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#ifndef DECODE_SWITCH_H
+#define DECODE_SWITCH_H
+
+#include "../src/decode.hh"
+
+namespace Bench {
+
+// 原来手写的嵌套 switch 解码器，保留作为表格驱动解码器的性能对照和正确性参照
+inline DecodedInst decode_switch(uint32_t inst) {
+    uint32_t opcode = inst & 0x7f;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t funct7 = (inst >> 25) & 0x7f;
+
+    DecodedInst d{};
+    d.op = Op::Illegal;
+    d.rd = (inst >> 7) & 0x1f;
+    d.rs1 = (inst >> 15) & 0x1f;
+    d.rs2 = (inst >> 20) & 0x1f;
+    d.raw = inst;
+
+    switch (opcode) {
+    case 0x37: // lui
+        d.op = Op::Lui;
+        d.imm = imm_u(inst);
+        break;
+    case 0x17: // auipc
+        d.op = Op::Auipc;
+        d.imm = imm_u(inst);
+        break;
+    case 0x6f: // jal
+        d.op = Op::Jal;
+        d.imm = imm_j(inst);
+        break;
+    case 0x67: // jalr
+        if (funct3 == 0) {
+            d.op = Op::Jalr;
+            d.imm = imm_i(inst);
+        }
+        break;
+    case 0x63: { // branch
+        constexpr Op ops[8] = {Op::Beq,     Op::Bne, Op::Illegal, Op::Illegal,
+                               Op::Blt,     Op::Bge, Op::Bltu,    Op::Bgeu};
+        d.op = ops[funct3];
+        d.imm = imm_b(inst);
+        break;
+    }
+    case 0x03: { // load
+        constexpr Op ops[8] = {Op::Lb,  Op::Lh,  Op::Lw,  Op::Ld,
+                               Op::Lbu, Op::Lhu, Op::Lwu, Op::Illegal};
+        d.op = ops[funct3];
+        d.imm = imm_i(inst);
+        break;
+    }
+    case 0x23: { // store
+        constexpr Op ops[8] = {Op::Sb,      Op::Sh,      Op::Sw,
+                               Op::Sd,      Op::Illegal, Op::Illegal,
+                               Op::Illegal, Op::Illegal};
+        d.op = ops[funct3];
+        d.imm = imm_s(inst);
+        break;
+    }
+    case 0x13: { // op-imm
+        d.imm = imm_i(inst);
+        // RV64 的移位量是6位，funct6 区分逻辑/算术右移
+        uint32_t funct6 = inst >> 26;
+        switch (funct3) {
+        case 0x0: d.op = Op::Addi; break;
+        case 0x2: d.op = Op::Slti; break;
+        case 0x3: d.op = Op::Sltiu; break;
+        case 0x4: d.op = Op::Xori; break;
+        case 0x6: d.op = Op::Ori; break;
+        case 0x7: d.op = Op::Andi; break;
+        case 0x1:
+            if (funct6 == 0) {
+                d.op = Op::Slli;
+                d.imm &= 0x3f;
+            }
+            break;
+        case 0x5:
+            if (funct6 == 0x00 || funct6 == 0x10) {
+                d.op = funct6 ? Op::Srai : Op::Srli;
+                d.imm &= 0x3f;
+            }
+            break;
+        }
+        break;
+    }
+    case 0x33: // op
+        if (funct7 == 0x00) {
+            constexpr Op ops[8] = {Op::Add, Op::Sll, Op::Slt, Op::Sltu,
+                                   Op::Xor, Op::Srl, Op::Or,  Op::And};
+            d.op = ops[funct3];
+        } else if (funct7 == 0x20) {
+            if (funct3 == 0x0) {
+                d.op = Op::Sub;
+            } else if (funct3 == 0x5) {
+                d.op = Op::Sra;
+            }
+        }
+        break;
+    case 0x1b: // op-imm-32
+        d.imm = imm_i(inst);
+        if (funct3 == 0x0) {
+            d.op = Op::Addiw;
+        } else if (funct3 == 0x1 && funct7 == 0x00) {
+            d.op = Op::Slliw;
+            d.imm &= 0x1f;
+        } else if (funct3 == 0x5 && (funct7 == 0x00 || funct7 == 0x20)) {
+            d.op = funct7 ? Op::Sraiw : Op::Srliw;
+            d.imm &= 0x1f;
+        }
+        break;
+    case 0x3b: // op-32
+        if (funct7 == 0x00) {
+            if (funct3 == 0x0) {
+                d.op = Op::Addw;
+            } else if (funct3 == 0x1) {
+                d.op = Op::Sllw;
+            } else if (funct3 == 0x5) {
+                d.op = Op::Srlw;
+            }
+        } else if (funct7 == 0x20) {
+            if (funct3 == 0x0) {
+                d.op = Op::Subw;
+            } else if (funct3 == 0x5) {
+                d.op = Op::Sraw;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return d;
+}
+
+} // namespace Bench
+
+#endif
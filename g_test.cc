@@ -1,7 +1,20 @@
+#include <cstddef>
+#include <cstring>
 #include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
 #include <vector>
 
+#include <elf.h>
+#include <unistd.h>
+
+#include "src/aot.hh"
 #include "src/cpu.hh"
+#include "src/elf.hh"
+#include "src/encode.hh"
+#include "src/uart.hh"
 #include "gtest/gtest.h"
 
 void generate_rv_assembly(const std::string &c_src) {
@@ -35,20 +48,6 @@ void generate_rv_obj(const std::string &assembly) {
     }
 }
 
-void generate_rv_binary(const std::string &obj) {
-    std::string command_line =
-        " riscv64-unknown-elf-objcopy -O binary " + obj + " " + obj + ".bin";
-
-    // 执行命令
-    int result = std::system(command_line.c_str());
-
-    // 检查命令执行结果
-    if (result != 0) {
-        std::cerr << "Failed to generate RV binary from object: " << obj
-                  << std::endl;
-    }
-}
-
 // 生成测试用的Cpu实例，code是测试指令，test_name是测试用例名称，n_clock是周期数
 // 比如 code = "addi x31, x0, 0" test_name = "test-addi"
 Cpu rv_helper(const std::string &code, const std::string &test_name,
@@ -66,41 +65,159 @@ Cpu rv_helper(const std::string &code, const std::string &test_name,
     file << code;
     file.close();
 
-    // 生成目标文件和二进制文件
+    // 生成可执行文件，直接加载其中的 PT_LOAD 段
     generate_rv_obj(filename);
-    generate_rv_binary(test_name);
+    auto program = load_elf(test_name);
+    if (!program) {
+        throw std::runtime_error(program.error());
+    }
+
+    Cpu cpu(program->image);
+    cpu.pc = program->entry;
+    cpu.run(n_clock);
+    return cpu;
+}
 
-    // 读取二进制文件
-    std::string bin_name = test_name + ".bin";
-    std::ifstream file_bin(bin_name, std::ios::binary);
+// 直接由机器码生成Cpu实例，不依赖交叉工具链，执行至多n_clock条指令
+Cpu rv_code_helper(const std::vector<uint32_t> &insts, size_t n_clock) {
+    Cpu cpu(Rv::to_bytes(insts));
+    cpu.run(n_clock);
+    return cpu;
+}
 
-    if (!file_bin.is_open()) {
-        throw std::runtime_error("Failed to open binary file.");
-    }
+// 以基本块引擎执行机器码，直到遇到非法指令
+Cpu rv_run_helper(const std::vector<uint32_t> &insts) {
+    Cpu cpu(Rv::to_bytes(insts));
+    cpu.run();
+    return cpu;
+}
 
-    std::vector<uint8_t> bin_code(std::istreambuf_iterator<char>(file_bin), {});
+// 分别用 switch 解释器和指定的引擎运行同一段机器码，比较最终状态。
+// 即时编译器在基本块第一次执行时就编译
+void expect_engine_matches_interpreter(const std::vector<uint32_t> &insts,
+                                       Engine engine) {
+    Cpu interp(Rv::to_bytes(insts));
+    interp.run();
 
-    Cpu cpu(bin_code);
+    Cpu other(Rv::to_bytes(insts));
+    other.engine = engine;
+    other.jit_threshold = 1;
+    other.run();
 
-    for (size_t i = 0; i < n_clock; i++) {
-        try {
-            auto inst = cpu.fetch();
-            auto next_pc = cpu.execute(inst.value());
+    for (size_t i = 1; i < 32; i++) {
+        EXPECT_EQ(other.regs[i], interp.regs[i]) << "x" << i;
+    }
+    EXPECT_EQ(other.pc, interp.pc);
+    for (uint64_t addr = 0x2000; addr < 0x2800; addr += 8) {
+        EXPECT_EQ(other.load(addr, 64), interp.load(addr, 64)) << addr;
+    }
+}
 
-            if (next_pc.has_value()) {
-                cpu.pc = next_pc.value();
-            } else {
-                break;
-            }
-        } catch (const std::exception &e) {
-            std::cerr << "CPU execution error: " << e.what() << std::endl;
+// 随机生成的循环程序：x5 为循环计数，x20 指向 0x2000 处的数据区，
+// 循环体由随机的运算、访存和短距离前向分支组成
+std::vector<uint32_t> random_program(uint32_t seed) {
+    std::mt19937 rng(seed);
+    auto pick = [&](uint32_t lo, uint32_t hi) {
+        return std::uniform_int_distribution<uint32_t>(lo, hi)(rng);
+    };
+    auto reg = [&] { return pick(6, 19); };
+    auto imm12 = [&] { return static_cast<int32_t>(pick(0, 4095)) - 2048; };
+
+    std::vector<uint32_t> code;
+    for (uint32_t r = 6; r <= 19; r++) {
+        code.push_back(Rv::lui(r, static_cast<int32_t>(pick(0, 0xfffff))));
+        code.push_back(Rv::addi(r, r, imm12()));
+    }
+    code.push_back(Rv::lui(20, 2));
+    code.push_back(Rv::addi(5, 0, 20));
+
+    size_t loop = code.size();
+    for (int i = 0; i < 40; i++) {
+        uint32_t rd = reg(), rs1 = reg(), rs2 = reg();
+        switch (pick(0, 11)) {
+        case 0: {
+            const uint32_t ops[] = {Rv::add(rd, rs1, rs2), Rv::sub(rd, rs1, rs2),
+                                    Rv::xor_(rd, rs1, rs2), Rv::or_(rd, rs1, rs2),
+                                    Rv::and_(rd, rs1, rs2)};
+            code.push_back(ops[pick(0, 4)]);
+            break;
+        }
+        case 1: {
+            const uint32_t ops[] = {Rv::sll(rd, rs1, rs2), Rv::srl(rd, rs1, rs2),
+                                    Rv::sra(rd, rs1, rs2), Rv::slt(rd, rs1, rs2),
+                                    Rv::sltu(rd, rs1, rs2)};
+            code.push_back(ops[pick(0, 4)]);
+            break;
+        }
+        case 2: {
+            const uint32_t ops[] = {Rv::addi(rd, rs1, imm12()),
+                                    Rv::xori(rd, rs1, imm12()),
+                                    Rv::andi(rd, rs1, imm12()),
+                                    Rv::slti(rd, rs1, imm12()),
+                                    Rv::i_type(0x13, rd, 3, rs1, imm12()),
+                                    Rv::i_type(0x13, rd, 6, rs1, imm12())};
+            code.push_back(ops[pick(0, 5)]);
+            break;
+        }
+        case 3: {
+            uint32_t sh = pick(0, 63);
+            const uint32_t ops[] = {Rv::slli(rd, rs1, sh), Rv::srli(rd, rs1, sh),
+                                    Rv::srai(rd, rs1, sh)};
+            code.push_back(ops[pick(0, 2)]);
+            break;
+        }
+        case 4: {
+            uint32_t sh = pick(0, 31);
+            const uint32_t ops[] = {
+                Rv::addiw(rd, rs1, imm12()), Rv::addw(rd, rs1, rs2),
+                Rv::subw(rd, rs1, rs2),
+                Rv::i_type(0x1b, rd, 1, rs1, static_cast<int32_t>(sh)),
+                Rv::i_type(0x1b, rd, 5, rs1, static_cast<int32_t>(sh)),
+                Rv::i_type(0x1b, rd, 5, rs1, static_cast<int32_t>(sh | 0x400)),
+                Rv::r_type(0x3b, rd, 1, rs1, rs2, 0),
+                Rv::r_type(0x3b, rd, 5, rs1, rs2, 0),
+                Rv::r_type(0x3b, rd, 5, rs1, rs2, 0x20)};
+            code.push_back(ops[pick(0, 8)]);
+            break;
+        }
+        case 5:
+        case 6: {
+            // 访存宽度与偏移对齐
+            uint32_t funct3 = pick(0, 6);
+            int32_t off = static_cast<int32_t>(pick(0, 255) * 8);
+            code.push_back(Rv::i_type(0x03, rd, funct3, 20, off));
+            break;
+        }
+        case 7:
+        case 8: {
+            int32_t off = static_cast<int32_t>(pick(0, 255) * 8);
+            code.push_back(Rv::s_type(0x23, pick(0, 3), 20, rs1, off));
+            break;
+        }
+        case 9: {
+            // 跳过下一条指令的前向分支
+            const uint32_t funct3s[] = {0, 1, 4, 5, 6, 7};
+            code.push_back(Rv::b_type(funct3s[pick(0, 5)], rs1, rs2, 8));
+            code.push_back(Rv::addi(rd, rd, 1));
+            break;
+        }
+        case 10:
+            code.push_back(Rv::lui(rd, static_cast<int32_t>(pick(0, 0xfffff))));
+            break;
+        default:
+            code.push_back(Rv::auipc(rd, static_cast<int32_t>(pick(0, 0xff))));
             break;
         }
     }
-
-    return cpu;
+    code.push_back(Rv::addi(5, 5, -1));
+    code.push_back(Rv::bne(5, 0, static_cast<int32_t>(loop - code.size()) * 4));
+    code.push_back(0);
+    return code;
 }
 
+// test/aot-smc.bin 在构建时离线翻译生成的镜像
+extern const AotImage aot_smc_image;
+
 // 消除警告： warning: cannot find entry symbol _start; defaulting to
 // 0000000000000000
 const std::string start = ".global _start \n _start: \n";
@@ -122,4 +239,1234 @@ TEST(RVTests, TestAdd) {
     Cpu cpu = rv_helper(code, "test_add", 3);
     EXPECT_EQ(cpu.regs[1], 30)
         << "Error: x1 should be the result of ADD instruction";
-}
\ No newline at end of file
+}
+
+// 预解码后的立即数需要正确地符号扩展
+TEST(RVTests, TestDecodeImmediates) {
+    EXPECT_EQ(decode(Rv::addi(1, 2, -5)).imm, -5);
+    EXPECT_EQ(decode(Rv::sd(3, 4, -16)).imm, -16);
+    EXPECT_EQ(decode(Rv::bne(5, 0, -28)).imm, -28);
+    EXPECT_EQ(decode(Rv::beq(5, 0, 4094)).imm, 4094);
+    EXPECT_EQ(decode(Rv::jal(1, -2048)).imm, -2048);
+    EXPECT_EQ(decode(Rv::lui(1, 0x80000)).imm, -0x80000000LL);
+    EXPECT_EQ(decode(0).op, Op::Illegal);
+}
+
+// 表格驱动解码：funct3/funct7 区分的各条指令，以及未定义的编码
+TEST(RVTests, TestDecodeTable) {
+    EXPECT_EQ(decode(Rv::add(1, 2, 3)).op, Op::Add);
+    EXPECT_EQ(decode(Rv::sub(1, 2, 3)).op, Op::Sub);
+    EXPECT_EQ(decode(Rv::sra(1, 2, 3)).op, Op::Sra);
+    EXPECT_EQ(decode(Rv::subw(1, 2, 3)).op, Op::Subw);
+    EXPECT_EQ(decode(Rv::lbu(1, 2, 3)).op, Op::Lbu);
+    EXPECT_EQ(decode(Rv::bgeu(1, 2, 8)).op, Op::Bgeu);
+
+    // RV64 的移位量有6位，第6位落在 funct7 的最低位上
+    DecodedInst srai = decode(Rv::srai(1, 2, 63));
+    EXPECT_EQ(srai.op, Op::Srai);
+    EXPECT_EQ(srai.imm, 63);
+    DecodedInst srli = decode(Rv::srli(1, 2, 33));
+    EXPECT_EQ(srli.op, Op::Srli);
+    EXPECT_EQ(srli.imm, 33);
+
+    // 未定义的 funct7/funct3 组合
+    EXPECT_EQ(decode(Rv::sll(1, 2, 3) | 0x40000000u).op, Op::Illegal);
+    EXPECT_EQ(decode(Rv::add(1, 2, 3) | 0x02000000u).op, Op::Illegal);
+    EXPECT_EQ(decode(Rv::b_type(2, 1, 2, 8)).op, Op::Illegal);
+    EXPECT_EQ(decode(Rv::jalr(1, 2, 0) | 0x1000u).op, Op::Illegal);
+    // 最低两位不是 11 的属于压缩指令
+    EXPECT_EQ(decode(Rv::add(1, 2, 3) & ~0x3u).op, Op::Illegal);
+}
+
+// 循环执行：预解码缓存命中后结果与逐条解码一致
+TEST(RVTests, TestLoopPredecoded) {
+    std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 10),
+        Rv::addi(6, 6, 3),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -8),
+    };
+    Cpu cpu = rv_code_helper(code, 100);
+    EXPECT_EQ(cpu.regs[6], 30);
+    EXPECT_EQ(cpu.pc, 16);
+}
+
+// DRAM 按需分配：没写过的地方读出来是0，拷贝 Cpu 后两份内存互不影响
+TEST(RVTests, TestDramCopy) {
+    Cpu cpu(Rv::to_bytes({Rv::addi(5, 0, 1)}));
+    EXPECT_EQ(cpu.load(DRAM_END - 7, 64), 0);
+    EXPECT_TRUE(cpu.store(DRAM_BASE + 0x10000, 64, 0x1122334455667788));
+    EXPECT_TRUE(cpu.store(DRAM_END - 7, 64, 42));
+
+    Cpu copy(cpu);
+    EXPECT_EQ(copy.load(DRAM_BASE, 32), Rv::addi(5, 0, 1));
+    EXPECT_EQ(copy.load(DRAM_BASE + 0x10000, 64), 0x1122334455667788);
+    EXPECT_EQ(copy.load(DRAM_END - 7, 64), 42);
+    EXPECT_TRUE(copy.store(DRAM_END - 7, 64, 7));
+    EXPECT_EQ(cpu.load(DRAM_END - 7, 64), 42);
+    EXPECT_FALSE(copy.store(DRAM_END - 3, 64, 7));
+}
+
+// 每种宽度的 load<T>/store<T> 和按位数转发的 load/store：最后一个合法位置
+// ram_size - sizeof(T) 可以访问，再往后一个字节越界。读出的值零扩展到64位，
+// 有符号的 load 指令在此基础上做符号扩展
+template <MemWord T> void expect_memory_width() {
+    constexpr uint64_t bits = sizeof(T) * 8;
+    SCOPED_TRACE(bits);
+    const auto top = static_cast<T>((uint64_t{1} << (bits - 1)) | 0x5a);
+
+    Dram dram(MachineConfig::virt(1 << 20), std::vector<uint8_t>{});
+    const uint64_t last = dram.base() + dram.size() - sizeof(T);
+    EXPECT_TRUE(dram.store<T>(last, top).has_value());
+    EXPECT_EQ(dram.load<T>(last).value(), top);
+    EXPECT_EQ(dram.load(last, bits).value(), top);
+    EXPECT_TRUE(dram.store(last, bits, ~uint64_t{0}).has_value());
+    EXPECT_EQ(dram.load(last, bits).value(), static_cast<T>(~T{0}));
+    EXPECT_EQ(dram.load<uint8_t>(last - 1).value(), 0);
+    EXPECT_EQ(dram.load<T>(last + 1).error().getCode(), 5);
+    EXPECT_EQ(dram.load(last + 1, bits).error().getCode(), 5);
+    EXPECT_EQ(dram.store<T>(last + 1, top).error().getCode(), 7);
+    EXPECT_EQ(dram.store(last + 1, bits, top).error().getCode(), 7);
+
+    Cpu cpu(Rv::to_bytes({Rv::addi(5, 0, 1)}));
+    const uint64_t edge = DRAM_END + 1 - sizeof(T);
+    EXPECT_TRUE(cpu.store<T>(edge, top));
+    EXPECT_EQ(cpu.load<T>(edge), top);
+    EXPECT_EQ(cpu.load(edge, bits), top);
+    EXPECT_FALSE(cpu.load<T>(edge + 1).has_value());
+    EXPECT_EQ(cpu.trap->getCode(), 5);
+    EXPECT_FALSE(cpu.store(edge + 1, bits, top));
+    EXPECT_EQ(cpu.trap->getCode(), 7);
+}
+
+TEST(RVTests, TestMemoryWidths) {
+    expect_memory_width<uint8_t>();
+    expect_memory_width<uint16_t>();
+    expect_memory_width<uint32_t>();
+    expect_memory_width<uint64_t>();
+
+    // 指令经过同一组接口访问 RAM 末尾：lb/lh/lw 符号扩展，lbu/lhu/lwu 零扩展
+    Cpu cpu(Rv::to_bytes({
+        Rv::lui(7, (DRAM_END + 1) >> 12),
+        Rv::lb(10, 7, -1),
+        Rv::lbu(11, 7, -1),
+        Rv::lh(12, 7, -2),
+        Rv::lhu(13, 7, -2),
+        Rv::lw(14, 7, -4),
+        Rv::lwu(15, 7, -4),
+        Rv::ld(16, 7, -8),
+        0,
+    }));
+    EXPECT_TRUE(cpu.store(DRAM_END - 7, 64, 0x80c0ffee8000ff80));
+    cpu.run();
+    EXPECT_EQ(cpu.regs[10], 0xffffffffffffff80);
+    EXPECT_EQ(cpu.regs[11], 0x80);
+    EXPECT_EQ(cpu.regs[12], 0xffffffffffff80c0);
+    EXPECT_EQ(cpu.regs[13], 0x80c0);
+    EXPECT_EQ(cpu.regs[14], 0xffffffff80c0ffee);
+    EXPECT_EQ(cpu.regs[15], 0x80c0ffee);
+    EXPECT_EQ(cpu.regs[16], 0x80c0ffee8000ff80);
+}
+
+// RAM 不从0开始时，访存快速路径只覆盖 [ram_base, ram_base + ram_size)：
+// 跨过 RAM 末尾的访问整个失败、不写入任何字节，紧挨着 RAM 之外的地址交给总线，
+// 没有设备时产生访存异常，mtval 是访问的地址
+TEST(RVTests, TestRamEdgeAccess) {
+    const MachineConfig machine = MachineConfig::virt(1 << 20);
+    const uint64_t end = machine.ram_base + machine.ram_size;
+    struct Case {
+        uint32_t inst;
+        uint64_t mcause;
+        uint64_t mtval;
+    };
+    const Case cases[] = {
+        {Rv::ld(7, 5, -4), 5, end - 4}, // 跨过末尾读
+        {Rv::sd(6, 5, -4), 7, end - 4}, // 跨过末尾写
+        {Rv::lw(7, 5, 0), 5, end},      // 末尾之后
+        {Rv::sb(6, 5, 0), 7, end},
+        {Rv::lw(7, 8, -4), 5, machine.ram_base - 4}, // 开头之前
+        {Rv::sw(6, 8, -4), 7, machine.ram_base - 4},
+    };
+    for (const Case &c : cases) {
+        const std::vector<uint32_t> code = {
+            Rv::lui(5, 0x40080),
+            Rv::slli(5, 5, 1), // RAM 末尾
+            Rv::lui(8, 0x40000),
+            Rv::slli(8, 8, 1), // RAM 开头
+            Rv::addi(6, 0, -1),
+            c.inst,
+        };
+        for (Engine engine : {Engine::Block, Engine::Threaded,
+                              Engine::TailCall, Engine::Jit}) {
+            SCOPED_TRACE(static_cast<int>(engine));
+            Cpu cpu(Bus{machine, Rv::to_bytes(code)});
+            cpu.engine = engine;
+            cpu.jit_threshold = 1;
+            EXPECT_EQ(cpu.run(), StopReason::Trap);
+            EXPECT_EQ(cpu.mcause, c.mcause);
+            EXPECT_EQ(cpu.mtval, c.mtval);
+            EXPECT_EQ(cpu.regs[7], 0);
+            EXPECT_EQ(cpu.load(end - 8, 64), 0);
+        }
+    }
+
+    // 最后8个字节仍然走快速路径
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(Bus{machine, Rv::to_bytes({Rv::lui(5, 0x40080),
+                                           Rv::slli(5, 5, 1),
+                                           Rv::addi(6, 0, -3),
+                                           Rv::sd(6, 5, -8),
+                                           Rv::lw(7, 5, -4),
+                                           Rv::ld(8, 5, -8), 0})});
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(cpu.mcause, 2);
+        EXPECT_EQ(cpu.regs[7], ~uint64_t{0});
+        EXPECT_EQ(cpu.regs[8], ~uint64_t{0} - 2);
+    }
+}
+
+// 同一个共享镜像的多个实例互不影响；拷贝只复制写过的页，包括本地代码跨页写入的两页
+TEST(RVTests, TestGuestImageSharing) {
+    const std::vector<uint32_t> code = {
+        Rv::lui(7, 3),
+        Rv::addi(5, 0, 20),
+        Rv::addi(6, 6, 0x111), // loop:
+        Rv::sd(6, 7, -4),      // 跨越 0x3000 的写入
+        Rv::sd(6, 7, 0x100),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -16),
+        0,
+    };
+    auto image = std::make_shared<GuestImage>(Rv::to_bytes(code));
+
+    Cpu first(image);
+    first.engine = Engine::Jit;
+    first.jit_threshold = 1;
+    EXPECT_EQ(first.bus.touched_pages(), 0);
+    first.run();
+    EXPECT_EQ(first.regs[6], 20 * 0x111);
+    EXPECT_EQ(first.bus.touched_pages(), 2);
+
+    Cpu second(image);
+    EXPECT_EQ(second.load(DRAM_BASE, 32), code[0]);
+    EXPECT_EQ(second.load(0x2ffc, 64), 0);
+
+    Cpu clone(first);
+    EXPECT_EQ(clone.bus.touched_pages(), 2);
+    EXPECT_EQ(clone.load(0x2ffc, 64), 20 * 0x111);
+    EXPECT_EQ(clone.load(0x3100, 64), 20 * 0x111);
+    EXPECT_EQ(clone.load(DRAM_BASE + 4, 32), code[1]);
+
+    // 运行到一半拷贝，两份各自执行完结果相同
+    Cpu half(image);
+    half.engine = Engine::Jit;
+    half.jit_threshold = 1;
+    EXPECT_EQ(half.run(30), StopReason::Budget);
+    Cpu rest(half);
+    half.run();
+    rest.run();
+    EXPECT_EQ(rest.regs, half.regs);
+    EXPECT_EQ(rest.load(0x2ffc, 64), half.load(0x2ffc, 64));
+}
+
+// 直接映射镜像文件：客户机的写入只落在私有的页上，不会写回文件
+TEST(RVTests, TestGuestImageFile) {
+    const std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 7),
+        Rv::sd(5, 0, 0x100), // 改写镜像自己所在的页
+        Rv::ld(6, 0, 0x100),
+        0,
+    };
+    const std::vector<uint8_t> bytes = Rv::to_bytes(code);
+    {
+        std::ofstream out("guest_image_file.bin", std::ios::binary);
+        out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    }
+    EXPECT_EQ(GuestImage::open("guest_image_file.missing"), nullptr);
+    auto image = GuestImage::open("guest_image_file.bin");
+    ASSERT_NE(image, nullptr);
+    EXPECT_EQ(image->size(), bytes.size());
+
+    Cpu cpu(image);
+    EXPECT_EQ(cpu.run(), StopReason::Trap);
+    EXPECT_EQ(cpu.regs[6], 7);
+    EXPECT_EQ(cpu.load(DRAM_BASE + bytes.size(), 32), 0);
+
+    Cpu again(image);
+    EXPECT_EQ(again.load(DRAM_BASE + 0x100, 64), 0);
+    std::ifstream in("guest_image_file.bin", std::ios::binary);
+    EXPECT_EQ(std::vector<uint8_t>(std::istreambuf_iterator<char>(in), {}),
+              bytes);
+}
+
+// 镜像文件打开之后被截短：读不满的尾页报告为截短的镜像，而不是内存不足
+TEST(RVTests, TestGuestImageTruncated) {
+    {
+        std::ofstream out("guest_image_file.bin", std::ios::binary);
+        const std::vector<char> bytes(5000, 0x13);
+        out.write(bytes.data(), bytes.size());
+    }
+    auto image = GuestImage::open("guest_image_file.bin");
+    ASSERT_NE(image, nullptr);
+    ASSERT_EQ(truncate("guest_image_file.bin", 100), 0);
+    try {
+        Cpu cpu(image);
+        FAIL() << "truncated image was loaded";
+    } catch (const std::system_error &) {
+        FAIL() << "short read reported as an I/O error";
+    } catch (const std::runtime_error &e) {
+        EXPECT_EQ(std::string(e.what()),
+                  "truncated image: guest_image_file.bin");
+    }
+}
+
+// 手工构造的 ELF：代码段跨过一页，数据段只有8字节在文件里、其余是 .bss，
+// 另一段的文件偏移与地址不同余只能读入。段之外的文件内容都是 0xee，不能出现在客户机内存里
+TEST(RVTests, TestElfLoader) {
+    const std::vector<uint32_t> code = {
+        Rv::lui(7, 5),
+        Rv::ld(8, 7, 8),    // 数据段
+        Rv::ld(9, 7, 0x10), // .bss
+        Rv::lui(10, 9),
+        Rv::ld(11, 10, 0),
+        0,
+    };
+    std::vector<uint8_t> file(0x3500, 0xee);
+    auto put = [&file](uint64_t offset, const auto &value) {
+        std::memcpy(file.data() + offset, &value, sizeof(value));
+    };
+    const std::vector<uint8_t> text = Rv::to_bytes(code);
+    std::fill(file.begin() + 0x1000, file.begin() + 0x2800, 0);
+    std::copy(text.begin(), text.end(), file.begin() + 0x1000);
+    put(0x3008, uint64_t{0x1122334455667788});
+    put(0x3100, uint64_t{0x0123456789abcdef});
+
+    Elf64_Ehdr eh{};
+    std::memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS64;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_type = ET_EXEC;
+    eh.e_machine = EM_RISCV;
+    eh.e_entry = 0x1000;
+    eh.e_phoff = sizeof(Elf64_Ehdr);
+    eh.e_phentsize = sizeof(Elf64_Phdr);
+    eh.e_phnum = 3;
+    eh.e_shoff = 0x3400;
+    eh.e_shentsize = sizeof(Elf64_Shdr);
+    eh.e_shnum = 3;
+    put(0, eh);
+    const Elf64_Phdr phdrs[] = {
+        {PT_LOAD, PF_R | PF_X, 0x1000, 0x1000, 0x1000, 0x1800, 0x1800, 0x1000},
+        {PT_LOAD, PF_R | PF_W, 0x3008, 0x5008, 0x5008, 8, 0x3000, 0x1000},
+        {PT_LOAD, PF_R, 0x3100, 0x9000, 0x9000, 8, 8, 8},
+    };
+    put(eh.e_phoff, phdrs);
+
+    const char names[] = "\0_start\0counter";
+    std::memcpy(file.data() + 0x3300, names, sizeof(names));
+    const Elf64_Sym syms[] = {
+        {},
+        {1, ELF64_ST_INFO(STB_GLOBAL, STT_FUNC), 0, 1, 0x1000, 24},
+        {8, ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT), 0, 2, 0x5008, 8},
+    };
+    put(0x3200, syms);
+    const Elf64_Shdr shdrs[] = {
+        {},
+        {0, SHT_SYMTAB, 0, 0, 0x3200, sizeof(syms), 2, 1, 8, sizeof(Elf64_Sym)},
+        {0, SHT_STRTAB, 0, 0, 0x3300, sizeof(names), 0, 0, 1, 0},
+    };
+    put(eh.e_shoff, shdrs);
+    {
+        std::ofstream out("test_elf_loader.elf", std::ios::binary);
+        out.write(reinterpret_cast<const char *>(file.data()), file.size());
+    }
+
+    ASSERT_TRUE(is_elf("test_elf_loader.elf"));
+    auto program = load_elf("test_elf_loader.elf");
+    ASSERT_TRUE(program) << program.error();
+    EXPECT_EQ(program->entry, 0x1000);
+    ASSERT_EQ(program->symbols.size(), 2);
+    EXPECT_EQ(program->symbol_at(0x1010)->name, "_start");
+    EXPECT_EQ(program->symbol_at(0x500c)->name, "counter");
+    EXPECT_EQ(program->symbol_at(0x1018), nullptr);
+
+    Cpu cpu(program->image);
+    cpu.pc = program->entry;
+    EXPECT_EQ(cpu.run(), StopReason::Trap);
+    EXPECT_EQ(cpu.regs[8], 0x1122334455667788);
+    EXPECT_EQ(cpu.regs[9], 0);
+    EXPECT_EQ(cpu.regs[11], 0x0123456789abcdef);
+    EXPECT_EQ(cpu.load(0x800, 64), 0);
+    EXPECT_EQ(cpu.load(0x2800, 64), 0);
+    EXPECT_EQ(cpu.load(0x5000, 64), 0);
+    EXPECT_EQ(cpu.load(0x7ff8, 64), 0);
+    EXPECT_EQ(cpu.bus.touched_pages(), 0);
+
+    // 段落在 DRAM 之外
+    put(eh.e_phoff + offsetof(Elf64_Phdr, p_paddr), uint64_t{DRAM_SIZE});
+    {
+        std::ofstream out("test_elf_loader.elf", std::ios::binary);
+        out.write(reinterpret_cast<const char *>(file.data()), file.size());
+    }
+    EXPECT_FALSE(load_elf("test_elf_loader.elf"));
+}
+
+// 请求大页时 RAM 按 2MiB 对齐；hugetlbfs 没有预留时退回透明大页，行为与普通页相同
+TEST(RVTests, TestHugePages) {
+    const std::vector<uint32_t> code = {
+        Rv::lui(7, 0x400),
+        Rv::addi(6, 0, 99),
+        Rv::sd(6, 7, 0),
+        Rv::ld(8, 7, 0),
+        0,
+    };
+    for (HugePages huge : {HugePages::Transparent, HugePages::HugeTlb}) {
+        Cpu cpu(Rv::to_bytes(code), huge);
+        EXPECT_NE(cpu.bus.huge_pages(), HugePages::Off);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(cpu.bus.ram()) %
+                      Dram::HUGE_PAGE_SIZE,
+                  0);
+        cpu.run();
+        EXPECT_EQ(cpu.regs[8], 99);
+
+        Cpu copy(cpu);
+        EXPECT_EQ(copy.bus.huge_pages(), cpu.bus.huge_pages());
+        EXPECT_EQ(copy.load(0x400000, 64), 99);
+    }
+
+    auto image = std::make_shared<GuestImage>(Rv::to_bytes(code));
+    Cpu shared(image, HugePages::HugeTlb);
+    EXPECT_EQ(shared.load(DRAM_BASE, 32), code[0]);
+    EXPECT_EQ(Cpu(image).bus.huge_page_bytes(), 0);
+}
+
+// RAM 放在 0x8000_0000 的 virt 布局：各引擎的访存、融合的 auipc+ld 都按新的基地址计算，
+// 设备窗口里没有设备时访问出错，不合法的布局在创建时被拒绝
+TEST(RVTests, TestMachineConfig) {
+    const MachineConfig machine = MachineConfig::virt(4 << 20);
+    const uint64_t base = machine.ram_base;
+    const std::vector<uint32_t> code = {
+        Rv::auipc(20, 1),
+        Rv::auipc(8, 1),
+        Rv::ld(8, 8, 4), // 读取 base + 0x1008
+        Rv::addi(5, 0, 20),
+        Rv::ld(6, 20, 0), // loop:
+        Rv::addi(6, 6, 3),
+        Rv::sd(6, 20, 0),
+        Rv::add(9, 9, 8),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -20),
+        Rv::lui(10, 0x10000), // UART 窗口
+        Rv::sb(6, 10, 0),
+    };
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(Bus{machine, Rv::to_bytes(code)});
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        EXPECT_EQ(cpu.pc, base);
+        EXPECT_EQ(cpu.regs[2], base + (4 << 20) - 1);
+        EXPECT_TRUE(cpu.store(base + 0x1008, 64, 5));
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(cpu.regs[6], 60);
+        EXPECT_EQ(cpu.regs[9], 100);
+        EXPECT_EQ(cpu.load(base + 0x1000, 64), 60);
+        EXPECT_EQ(cpu.pc, base + 44);
+        EXPECT_EQ(cpu.mcause, 7);
+        EXPECT_EQ(cpu.mtval, 0x10000000);
+        EXPECT_EQ(cpu.load(DRAM_BASE, 32), std::nullopt);
+        EXPECT_EQ(cpu.load(base + (4 << 20), 8), std::nullopt);
+    }
+    Cpu aot(Bus{machine, Rv::to_bytes(code)});
+    EXPECT_FALSE(aot.attach(aot_smc_image));
+
+    MachineConfig bad = machine;
+    bad.ram_size = 100;
+    EXPECT_TRUE(bad.check());
+    bad = machine;
+    bad.devices.push_back({"overlap", base + 0x1000, 0x1000});
+    EXPECT_TRUE(bad.check());
+    EXPECT_THROW(Bus(bad, Rv::to_bytes(code)), std::invalid_argument);
+    EXPECT_FALSE(MachineConfig{}.check());
+}
+
+// 总线按页表把访问分派给窗口里的设备：写串口输出字符，读写设备寄存器，
+// 没有设备、越出窗口和从设备取指都产生访存异常
+TEST(RVTests, TestMmioDispatch) {
+    // 8 个 64 位寄存器，只接受按 64 位访问
+    class Registers : public Device {
+    public:
+        std::optional<uint64_t> load(uint64_t offset, uint64_t size) override {
+            if (size != 64 || offset >= sizeof(regs)) {
+                return std::nullopt;
+            }
+            return regs[offset / 8];
+        }
+        bool store(uint64_t offset, uint64_t size, uint64_t value) override {
+            if (size != 64 || offset >= sizeof(regs)) {
+                return false;
+            }
+            regs[offset / 8] = value;
+            return true;
+        }
+        uint64_t regs[8] = {};
+    };
+
+    const MachineConfig machine = MachineConfig::virt(1 << 20);
+    const std::vector<uint32_t> code = {
+        Rv::lui(10, 0x10000), // UART
+        Rv::addi(11, 0, 'H'),
+        Rv::sb(11, 10, 0),
+        Rv::addi(11, 0, 'i'),
+        Rv::sb(11, 10, 0),
+        Rv::lbu(12, 10, 5), // LSR
+        Rv::lui(13, 0x2000), // CLINT
+        Rv::sd(12, 13, 8),
+        Rv::ld(14, 13, 8),
+        Rv::lui(15, 0xc000), // PLIC 没有挂设备
+        Rv::sw(14, 15, 0),
+    };
+    for (Engine engine : {Engine::Block, Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        std::ostringstream out;
+        auto registers = std::make_shared<Registers>();
+        Cpu cpu(Bus{machine, Rv::to_bytes(code)});
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        EXPECT_TRUE(cpu.bus.attach("uart", std::make_shared<Uart>(out)));
+        EXPECT_TRUE(cpu.bus.attach("clint", registers));
+        EXPECT_FALSE(cpu.bus.attach("clint", registers));
+        EXPECT_FALSE(cpu.bus.attach("virtio", registers));
+        EXPECT_EQ(cpu.bus.device_at(0x0200'ffff), registers.get());
+        EXPECT_EQ(cpu.bus.device_at(0x0201'0000), nullptr);
+
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(out.str(), "Hi");
+        EXPECT_EQ(cpu.regs[14], 0x60);
+        EXPECT_EQ(registers->regs[1], 0x60);
+        EXPECT_EQ(cpu.mcause, 7);
+        EXPECT_EQ(cpu.mtval, 0x0c00'0000);
+
+        // 设备拒绝的访问和越出窗口的访问
+        EXPECT_EQ(cpu.load(0x0200'0008, 32), std::nullopt);
+        EXPECT_FALSE(cpu.bus.load<uint64_t>(0x0201'0000 - 4).has_value());
+        EXPECT_FALSE(cpu.bus.store<uint64_t>(0x0200'0040, 1).has_value());
+
+        // 复制的 Bus 共用设备
+        Bus copy = cpu.bus;
+        EXPECT_TRUE(copy.store<uint64_t>(0x0200'0000, 42).has_value());
+        EXPECT_EQ(registers->regs[0], 42);
+
+        // 不能从设备窗口取指
+        cpu.pc = 0x0200'0000;
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(cpu.mcause, 1);
+    }
+
+    // 窗口超出页表覆盖的范围
+    MachineConfig high = MachineConfig::virt(1 << 20);
+    high.devices.push_back({"high", Bus::MMIO_LIMIT, 0x1000});
+    Bus bus(high, Rv::to_bytes(code));
+    EXPECT_FALSE(bus.attach("high", std::make_shared<Uart>()));
+
+    // 不按页对齐的窗口即使不重叠也可能共用一页，布局不合法
+    MachineConfig shared = MachineConfig::virt(1 << 20);
+    shared.devices.push_back({"a", 0x2000'0000, 0x100});
+    shared.devices.push_back({"b", 0x2000'0100, 0x100});
+    EXPECT_TRUE(shared.check());
+    EXPECT_THROW(Bus(shared, Rv::to_bytes(code)), std::invalid_argument);
+    MachineConfig odd_size = MachineConfig::virt(1 << 20);
+    odd_size.devices.push_back({"a", 0x2000'0000, 0x1800});
+    EXPECT_TRUE(odd_size.check());
+}
+
+// 向代码页写入后，缓存中的旧指令必须失效
+TEST(RVTests, TestSelfModifyingCode) {
+    uint32_t patched = Rv::addi(31, 0, 7);
+    auto hi = static_cast<int32_t>((patched + 0x800) >> 12);
+    auto lo = static_cast<int32_t>(patched - (static_cast<uint32_t>(hi) << 12));
+    std::vector<uint32_t> code = {
+        Rv::lui(5, hi),
+        Rv::addi(5, 5, lo),
+        Rv::addi(31, 0, 1), // 被改写为 addi x31, x0, 7
+        Rv::bne(6, 0, 16),
+        Rv::sw(5, 0, 8),
+        Rv::addi(6, 0, 1),
+        Rv::jal(0, -16),
+    };
+    Cpu cpu = rv_code_helper(code, 100);
+    EXPECT_EQ(cpu.regs[31], 7);
+}
+
+// 脏页和代码页标记：各引擎的写入都记录脏页，清除脏页不影响拷贝用的写过标记；
+// 从数据页跨进代码页的写入也要让缓存的代码失效
+TEST(RVTests, TestDirtyPages) {
+    const uint32_t patched = Rv::addi(7, 0, 2);
+    auto hi = static_cast<int32_t>((patched + 0x800) >> 12);
+    auto lo = static_cast<int32_t>(patched - (static_cast<uint32_t>(hi) << 12));
+    std::vector<uint8_t> image = Rv::to_bytes({
+        Rv::lui(6, hi),
+        Rv::addi(6, 6, lo),
+        Rv::slli(6, 6, 32),
+        Rv::lui(9, 2),     // func 在 0x2000
+        Rv::jalr(1, 9, 0), // 第一次调用：x7 = 1
+        Rv::add(8, 8, 7),
+        Rv::sd(6, 9, -4), // 写入 0x1ffc..0x2003，高 4 字节改写 func 的第一条指令
+        Rv::jalr(1, 9, 0), // 第二次调用：x7 = 2
+        Rv::add(8, 8, 7),
+        Rv::lui(10, 3),
+        Rv::sd(8, 10, 0),
+        0,
+    });
+    image.resize(0x2000);
+    for (uint8_t b : Rv::to_bytes({Rv::addi(7, 0, 1), Rv::jalr(0, 1, 0)})) {
+        image.push_back(b);
+    }
+
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(image);
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        EXPECT_TRUE(cpu.bus.dirty_pages().empty());
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(cpu.regs[8], 3);
+        EXPECT_EQ(cpu.bus.dirty_pages(),
+                  (std::vector<uint64_t>{0x1000, 0x2000, 0x3000}));
+        EXPECT_TRUE(cpu.bus.has_code(0));
+        EXPECT_TRUE(cpu.bus.has_code(0x2000));
+        EXPECT_FALSE(cpu.bus.has_code(0x1000));
+        EXPECT_FALSE(cpu.bus.has_code(0x3000));
+
+        const size_t touched = cpu.bus.touched_pages();
+        cpu.bus.clear_dirty();
+        EXPECT_TRUE(cpu.bus.dirty_pages().empty());
+        EXPECT_EQ(cpu.bus.touched_pages(), touched);
+        EXPECT_TRUE(cpu.bus.has_code(0));
+
+        EXPECT_TRUE(cpu.store(0x5000, 64, 1));
+        EXPECT_TRUE(cpu.bus.dirty(0x5000));
+        EXPECT_FALSE(cpu.bus.dirty(0x4000));
+        EXPECT_FALSE(cpu.bus.dirty(DRAM_SIZE));
+        // 写入代码页清除它的代码标记，直到再次取指
+        EXPECT_TRUE(cpu.store<uint32_t>(0x2004, Rv::jalr(0, 1, 0)));
+        EXPECT_FALSE(cpu.bus.has_code(0x2000));
+        EXPECT_EQ(cpu.bus.dirty_pages(),
+                  (std::vector<uint64_t>{0x2000, 0x5000}));
+    }
+}
+
+// run(n) 恰好完成 n 条指令后停下，分几次执行与一次执行到底的结果相同
+TEST(RVTests, TestRunBudget) {
+    const auto code = Rv::to_bytes(random_program(3));
+    Cpu whole(code);
+    EXPECT_EQ(whole.run(), StopReason::Trap);
+
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(code);
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        cpu.trace_threshold = 1;
+        uint64_t slices = 0;
+        while (true) {
+            uint64_t before = cpu.instret;
+            StopReason reason = cpu.run(37);
+            if (reason != StopReason::Budget) {
+                EXPECT_EQ(reason, StopReason::Trap);
+                break;
+            }
+            EXPECT_EQ(cpu.instret - before, 37);
+            slices++;
+        }
+        EXPECT_EQ(slices, whole.instret / 37);
+        EXPECT_EQ(cpu.regs, whole.regs);
+        EXPECT_EQ(cpu.pc, whole.pc);
+        EXPECT_EQ(cpu.instret, whole.instret);
+    }
+
+    // 本地代码中的自循环和离线翻译的代码也在上限处停下
+    Cpu jitted(Rv::to_bytes({Rv::addi(5, 0, 100), Rv::addi(6, 6, 1),
+                             Rv::addi(5, 5, -1), Rv::bne(5, 0, -8)}));
+    jitted.engine = Engine::Jit;
+    jitted.jit_threshold = 1;
+    EXPECT_EQ(jitted.run(50), StopReason::Budget);
+    EXPECT_EQ(jitted.instret, 50);
+    EXPECT_EQ(jitted.run(), StopReason::Trap);
+    EXPECT_EQ(jitted.regs[6], 100);
+
+    std::vector<uint8_t> image(aot_smc_image.code,
+                               aot_smc_image.code + aot_smc_image.size);
+    Cpu reference(image);
+    reference.run();
+    Cpu aot(image);
+    ASSERT_TRUE(aot.attach(aot_smc_image));
+    for (uint64_t i = 0; aot.run(5) == StopReason::Budget; i++) {
+        EXPECT_EQ(aot.instret, (i + 1) * 5);
+    }
+    EXPECT_EQ(aot.regs, reference.regs);
+    EXPECT_EQ(aot.instret, reference.instret);
+    EXPECT_GT(aot.aot_instret, 0);
+}
+
+// run_until 在将要执行断点处的指令时停下，断点可以在块中间
+TEST(RVTests, TestRunUntilBreakpoint) {
+    std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 3),
+        Rv::addi(6, 6, 1),
+        Rv::addi(7, 7, 2), // 断点
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -12),
+    };
+    for (Engine engine : {Engine::Block, Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(Rv::to_bytes(code));
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        for (uint64_t i = 1; i <= 3; i++) {
+            EXPECT_EQ(cpu.run_until(8), StopReason::Breakpoint);
+            EXPECT_EQ(cpu.pc, 8);
+            EXPECT_EQ(cpu.regs[6], i);
+            EXPECT_EQ(cpu.regs[7], 2 * (i - 1));
+            // 越过断点继续
+            EXPECT_EQ(cpu.run(1), StopReason::Budget);
+        }
+        EXPECT_EQ(cpu.run_until(8), StopReason::Trap);
+        EXPECT_EQ(cpu.regs[7], 6);
+        EXPECT_EQ(cpu.pc, 20);
+    }
+}
+
+// 访存、取指和非法指令的异常在同一处写入 mepc/mcause/mtval，
+// 设置了 mtvec 时跳到异常处理程序继续执行
+TEST(RVTests, TestTrapEntry) {
+    struct Case {
+        uint32_t inst;
+        uint64_t mcause;
+        uint64_t mtval;
+    };
+    const Case cases[] = {
+        {Rv::ld(6, 5, 0), 5, ~uint64_t{0}},        // 读越界
+        {Rv::sd(6, 5, 0), 7, ~uint64_t{0}},        // 写越界
+        {0xffffffff, 2, 0xffffffff},               // 非法指令
+        {Rv::jalr(0, 5, -3), 1, ~uint64_t{0} - 3}, // 跳出 DRAM 后取指失败
+        {Rv::jalr(0, 7, 1), 0, 2},                 // 跳到不对齐的地址
+    };
+    for (const Case &c : cases) {
+        for (Engine engine : {Engine::Block, Engine::Threaded,
+                              Engine::TailCall, Engine::Jit}) {
+            SCOPED_TRACE(static_cast<int>(engine));
+            Cpu cpu(
+                Rv::to_bytes({Rv::addi(5, 0, -1), Rv::addi(7, 0, 1), c.inst}));
+            cpu.engine = engine;
+            cpu.jit_threshold = 1;
+            EXPECT_EQ(cpu.run(), StopReason::Trap);
+            ASSERT_TRUE(cpu.trap.has_value());
+            EXPECT_EQ(cpu.mcause, c.mcause);
+            EXPECT_EQ(cpu.mtval, c.mtval);
+            EXPECT_EQ(cpu.mepc, cpu.pc);
+            EXPECT_EQ(cpu.regs[7], 1);
+        }
+    }
+
+    // 异常处理程序计数后跳回出错的 ld，每轮完成2条指令
+    const std::vector<uint32_t> code = {
+        Rv::addi(5, 0, -1),
+        Rv::ld(6, 5, 0),
+        0,
+        Rv::addi(8, 8, 1), // 异常处理程序
+        Rv::jal(0, -12),
+    };
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(Rv::to_bytes(code));
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        cpu.mtvec = 12;
+        EXPECT_EQ(cpu.run(21), StopReason::Budget);
+        EXPECT_EQ(cpu.regs[8], 10);
+        EXPECT_EQ(cpu.mepc, 4);
+        EXPECT_EQ(cpu.mcause, 5);
+    }
+}
+
+// 跳到对齐地址 +2 处要报告取指地址不对齐，不能取到或改写预解码缓存里同一字的指令
+TEST(RVTests, TestMisalignedJump) {
+    const std::vector<uint32_t> code = {
+        Rv::auipc(6, 0),
+        Rv::jalr(0, 6, 18), // 跳到 16 + 2
+        0,
+        0,
+        Rv::addi(7, 0, 5),
+        0,
+    };
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(Rv::to_bytes(code));
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(cpu.mcause, 0);
+        EXPECT_EQ(cpu.mtval, 18);
+        EXPECT_EQ(cpu.pc, 18);
+
+        cpu.pc = 16;
+        EXPECT_EQ(cpu.run(), StopReason::Trap);
+        EXPECT_EQ(cpu.regs[7], 5);
+        EXPECT_EQ(cpu.mcause, 2);
+        EXPECT_EQ(cpu.pc, 20);
+    }
+
+    // 逐条执行也一样
+    Cpu cpu(Rv::to_bytes(code));
+    cpu.pc = 18;
+    EXPECT_FALSE(cpu.step().has_value());
+    ASSERT_TRUE(cpu.trap.has_value());
+    EXPECT_EQ(cpu.trap->getCode(), 0);
+    cpu.pc = 16;
+    EXPECT_EQ(cpu.step(), 20);
+    EXPECT_EQ(cpu.regs[7], 5);
+}
+
+// 执行日志：inst 级别每条指令一条记录，block 级别每次调度一条记录，最后是进入的异常
+TEST(RVTests, TestTraceSink) {
+    if (!TraceSink::compiled(TraceLevel::Inst)) {
+        GTEST_SKIP() << "CRVEMU_TRACE_LEVEL < 3";
+    }
+    const std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 3),
+        Rv::lui(6, 1),
+        Rv::addi(6, 6, 1), // 与 lui 融合
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -12),
+    };
+    Cpu plain = rv_run_helper(code);
+
+    for (Engine engine : {Engine::Block, Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        {
+            TraceSink sink("trace_sink_inst.bin", TraceLevel::Inst);
+            Cpu cpu(Rv::to_bytes(code));
+            cpu.engine = engine;
+            cpu.jit_threshold = 1;
+            cpu.trace_sink = &sink;
+            EXPECT_EQ(cpu.run(), StopReason::Trap);
+            EXPECT_EQ(cpu.regs, plain.regs);
+            EXPECT_EQ(cpu.instret, plain.instret);
+        }
+        // inst 级别同时包含基本块的记录
+        auto records = TraceSink::read("trace_sink_inst.bin");
+        ASSERT_FALSE(records.empty());
+        EXPECT_EQ(records.back().kind, TraceRecord::Trap);
+        EXPECT_EQ(records.back().aux, 2);
+        EXPECT_EQ(records.back().pc, plain.pc);
+        std::vector<TraceRecord> insts;
+        for (const TraceRecord &r : records) {
+            if (r.kind == TraceRecord::Inst) {
+                insts.push_back(r);
+            }
+        }
+        ASSERT_EQ(insts.size(), plain.instret);
+        for (uint64_t i = 0; i < insts.size(); i++) {
+            EXPECT_EQ(insts[i].instret, i);
+            EXPECT_EQ(insts[i].value, code[insts[i].pc / 4]);
+        }
+    }
+
+    {
+        TraceSink sink("trace_sink_block.bin", TraceLevel::Block);
+        Cpu cpu(Rv::to_bytes(code));
+        cpu.trace_sink = &sink;
+        cpu.run();
+    }
+    auto records = TraceSink::read("trace_sink_block.bin");
+    // 含第一轮循环的入口块、另外2次循环体、结尾的非法指令，最后是异常
+    ASSERT_EQ(records.size(), 5);
+    EXPECT_EQ(records[0].pc, 0);
+    EXPECT_EQ(records[0].value, 20);
+    EXPECT_EQ(records[1].pc, 4);
+    EXPECT_EQ(records[2].pc, 4);
+    EXPECT_EQ(records[3].pc, 20);
+    EXPECT_EQ(records[4].kind, TraceRecord::Trap);
+}
+
+// 基本块引擎：分支、函数调用与返回（jalr 间接跳转）
+TEST(RVTests, TestBlockEngineCall) {
+    std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 4),
+        Rv::jal(1, 16),      // call func
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -8),
+        Rv::jal(0, 16),      // 跳到结尾
+        Rv::addi(31, 31, 5), // func:
+        Rv::slli(30, 31, 1),
+        Rv::jalr(0, 1, 0),   // ret
+        0,
+    };
+    Cpu stepped = rv_code_helper(code, 1000);
+    Cpu blocked = rv_run_helper(code);
+    EXPECT_EQ(blocked.regs[31], 20);
+    EXPECT_EQ(blocked.regs[30], 40);
+    EXPECT_EQ(blocked.regs, stepped.regs);
+    EXPECT_EQ(blocked.pc, stepped.pc);
+}
+
+// 基本块引擎同样需要处理自修改代码
+TEST(RVTests, TestBlockEngineSelfModifyingCode) {
+    uint32_t patched = Rv::addi(31, 0, 7);
+    auto hi = static_cast<int32_t>((patched + 0x800) >> 12);
+    auto lo = static_cast<int32_t>(patched - (static_cast<uint32_t>(hi) << 12));
+    std::vector<uint32_t> code = {
+        Rv::lui(5, hi),
+        Rv::addi(5, 5, lo),
+        Rv::addi(31, 0, 1),
+        Rv::bne(6, 0, 16),
+        Rv::sw(5, 0, 8),
+        Rv::addi(6, 0, 1),
+        Rv::jal(0, -16),
+    };
+    Cpu cpu = rv_run_helper(code);
+    EXPECT_EQ(cpu.regs[31], 7);
+}
+
+// 即时编译器与解释器的差分测试：随机程序
+TEST(RVTests, TestJitDifferentialRandom) {
+    for (uint32_t seed = 1; seed <= 20; seed++) {
+        SCOPED_TRACE(seed);
+        expect_engine_matches_interpreter(random_program(seed), Engine::Jit);
+    }
+}
+
+// 即时编译器：函数调用、返回以及越界访存时从块中间退出
+TEST(RVTests, TestJitDifferentialControlFlow) {
+    expect_engine_matches_interpreter({
+        Rv::addi(5, 0, 4),
+        Rv::jal(1, 16),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -8),
+        Rv::jal(0, 16),
+        Rv::addi(31, 31, 5),
+        Rv::slli(30, 31, 1),
+        Rv::jalr(0, 1, 0),
+        Rv::lui(7, 0x10000),
+        Rv::addi(8, 0, 3),
+        Rv::ld(6, 7, 0), // 超出 DRAM 范围
+        Rv::addi(8, 0, 9),
+    }, Engine::Jit);
+}
+
+// 本地代码之间直接链接、jalr 经过内联缓存跳转时，结果、各块的计数和
+// 指令数上限都与调度器逐块执行时相同。两处调用让返回地址的缓存有命中也有未命中
+TEST(RVTests, TestJitChaining) {
+    const std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 50),
+        // loop:
+        Rv::jal(1, 28),      // call f
+        Rv::addi(6, 10, 0),
+        Rv::jal(1, 20),      // call f
+        Rv::add(7, 7, 10),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -20),
+        0,
+        // f:
+        Rv::addi(10, 10, 3),
+        Rv::xori(10, 10, 1),
+        Rv::jalr(0, 1, 0),
+    };
+    Cpu plain(Rv::to_bytes(code));
+    EXPECT_EQ(plain.run(), StopReason::Trap);
+
+    Cpu jitted(Rv::to_bytes(code));
+    jitted.engine = Engine::Jit;
+    jitted.jit_threshold = 1;
+    EXPECT_EQ(jitted.run(), StopReason::Trap);
+    EXPECT_EQ(jitted.regs, plain.regs);
+    EXPECT_EQ(jitted.pc, plain.pc);
+    EXPECT_EQ(jitted.instret, plain.instret);
+    for (const Block *block : plain.block_cache().hottest(1000)) {
+        const Block *same = jitted.block_cache().find(block->start);
+        ASSERT_NE(same, nullptr) << block->start;
+        EXPECT_EQ(same->hits, block->hits) << block->start;
+        EXPECT_EQ(same->loop_hits, block->loop_hits) << block->start;
+    }
+
+    Cpu sliced(Rv::to_bytes(code));
+    sliced.engine = Engine::Jit;
+    sliced.jit_threshold = 1;
+    while (sliced.run(7) == StopReason::Budget) {
+        EXPECT_EQ(sliced.instret % 7, 0);
+    }
+    EXPECT_EQ(sliced.regs, plain.regs);
+    EXPECT_EQ(sliced.instret, plain.instret);
+}
+
+// 即时编译的代码写入代码页时必须退回解释器并使缓存失效
+TEST(RVTests, TestJitSelfModifyingCode) {
+    uint32_t patched = Rv::addi(31, 0, 7);
+    auto hi = static_cast<int32_t>((patched + 0x800) >> 12);
+    auto lo = static_cast<int32_t>(patched - (static_cast<uint32_t>(hi) << 12));
+    std::vector<uint32_t> code = {
+        Rv::lui(5, hi),
+        Rv::addi(5, 5, lo),
+        Rv::addi(31, 0, 1),
+        Rv::bne(6, 0, 16),
+        Rv::sw(5, 0, 8),
+        Rv::addi(6, 0, 1),
+        Rv::jal(0, -16),
+    };
+    Cpu cpu(Rv::to_bytes(code));
+    cpu.engine = Engine::Jit;
+    cpu.jit_threshold = 1;
+    cpu.run();
+    EXPECT_EQ(cpu.regs[31], 7);
+}
+
+// 寄存器分配：自循环块在宿主机寄存器中迭代，访存越界退出时要先写回客户机寄存器
+TEST(RVTests, TestJitRegisterAllocation) {
+    std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 100),
+        Rv::lui(7, 0x8000),
+        Rv::addi(7, 7, -80), // DRAM 末尾之前 10 个双字
+        // loop:
+        Rv::ld(8, 7, 0),
+        Rv::add(6, 6, 8),
+        Rv::xori(9, 6, 0x55),
+        Rv::addi(7, 7, 8),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 0, -20),
+        Rv::addi(31, 0, 1),
+    };
+    Cpu interp(Rv::to_bytes(code));
+    interp.run();
+    EXPECT_EQ(interp.regs[5], 90);
+
+    for (bool allocate : {false, true}) {
+        SCOPED_TRACE(allocate);
+        Cpu cpu(Rv::to_bytes(code));
+        cpu.engine = Engine::Jit;
+        cpu.jit_threshold = 1;
+        cpu.jit_regalloc = allocate;
+        cpu.run();
+        EXPECT_EQ(cpu.regs, interp.regs);
+        EXPECT_EQ(cpu.pc, interp.pc);
+        EXPECT_EQ(cpu.instret, interp.instret);
+    }
+    for (uint32_t seed = 1; seed <= 5; seed++) {
+        SCOPED_TRACE(seed);
+        auto program = Rv::to_bytes(random_program(seed));
+        Cpu with(program), without(program);
+        with.engine = without.engine = Engine::Jit;
+        with.jit_threshold = without.jit_threshold = 1;
+        without.jit_regalloc = false;
+        with.run();
+        without.run();
+        EXPECT_EQ(with.regs, without.regs);
+        EXPECT_EQ(with.instret, without.instret);
+    }
+}
+
+// 线索化分派的解释器核心与 switch 核心结果一致
+TEST(RVTests, TestThreadedDifferentialRandom) {
+    for (uint32_t seed = 1; seed <= 10; seed++) {
+        SCOPED_TRACE(seed);
+        expect_engine_matches_interpreter(random_program(seed),
+                                          Engine::Threaded);
+    }
+}
+
+// 尾调用解释器核心与 switch 核心结果一致
+TEST(RVTests, TestTailCallDifferentialRandom) {
+    for (uint32_t seed = 1; seed <= 10; seed++) {
+        SCOPED_TRACE(seed);
+        expect_engine_matches_interpreter(random_program(seed),
+                                          Engine::TailCall);
+    }
+}
+// 融合指令与分别执行两条指令的结果一致，包括 instret 和在 auipc+ld 的 ld 处出错
+TEST(RVTests, TestFusionMatchesUnfused) {
+    const std::vector<uint32_t> insts = {
+        Rv::addi(5, 0, 3),
+        Rv::lui(6, 0x12345), // lui+addi
+        Rv::addi(6, 6, -1),
+        Rv::slli(7, 6, 40), // slli+srli
+        Rv::srli(7, 7, 48),
+        Rv::auipc(8, 2), // auipc+ld，读取 0x2000
+        Rv::ld(9, 8, -20),
+        Rv::auipc(1, 0), // auipc+jalr，调用 64 处的函数
+        Rv::jalr(1, 1, 36),
+        Rv::addi(5, 5, -1),
+        Rv::slt(10, 0, 5), // slt+bnez
+        Rv::bne(10, 0, -40),
+        Rv::sltu(11, 5, 6), // sltu+beqz
+        Rv::beq(11, 0, 8),
+        Rv::auipc(12, 0x10000), // 超出 DRAM 范围
+        Rv::ld(13, 12, 0),
+        Rv::addi(31, 31, 1),
+        Rv::jalr(0, 1, 0),
+    };
+    Cpu unfused(Rv::to_bytes(insts));
+    unfused.fusion = false;
+    unfused.run();
+    EXPECT_EQ(unfused.fusion_stats.total_executed(), 0);
+    EXPECT_EQ(unfused.regs[31], 3);
+
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu fused(Rv::to_bytes(insts));
+        fused.engine = engine;
+        fused.jit_threshold = 1;
+        fused.run();
+        for (size_t i = 1; i < 32; i++) {
+            EXPECT_EQ(fused.regs[i], unfused.regs[i]) << "x" << i;
+        }
+        EXPECT_EQ(fused.pc, unfused.pc);
+        EXPECT_EQ(fused.instret, unfused.instret);
+        for (size_t kind = 0; kind < FusionStats::KINDS; kind++) {
+            EXPECT_GT(fused.fusion_stats.translated[kind], 0)
+                << FusionStats::name(kind);
+        }
+        if (engine != Engine::Jit) {
+            EXPECT_GT(fused.fusion_stats.total_executed(), 0);
+            // 循环里的 auipc+ld 执行了3次，最后在 ld 处出错的一对不计数
+            EXPECT_EQ(fused.fusion_stats
+                          .executed[FusionStats::kind(Op::AuipcLd)],
+                      3);
+        }
+    }
+}
+
+// 写 x0 的指令（包括访存和跳转）都写入丢弃槽位，x0 读出来始终是0
+TEST(RVTests, TestZeroRegisterSink) {
+    EXPECT_EQ(sink_x0(decode(Rv::ld(0, 5, 0))).rd, ZERO_SINK);
+    EXPECT_EQ(sink_x0(decode(Rv::ld(1, 5, 0))).rd, 1);
+
+    const std::vector<uint32_t> insts = {
+        Rv::addi(0, 0, 5),
+        Rv::lui(0, 1),
+        Rv::addi(6, 0, 0x100),
+        Rv::sd(6, 6, 0),
+        Rv::ld(0, 6, 0),
+        Rv::add(7, 0, 6),
+        Rv::jal(0, 8),
+        Rv::addi(7, 0, 1), // 被跳过
+        Rv::sltu(0, 0, 6),
+        Rv::addi(8, 0, 0),
+    };
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall,
+                          Engine::Jit}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        Cpu cpu(Rv::to_bytes(insts));
+        cpu.engine = engine;
+        cpu.jit_threshold = 1;
+        cpu.run();
+        EXPECT_EQ(cpu.regs[0], 0);
+        EXPECT_EQ(cpu.regs[7], 0x100);
+        EXPECT_EQ(cpu.regs[8], 0);
+        EXPECT_EQ(cpu.instret, 9);
+    }
+}
+
+// 轨迹执行层与逐块执行结果一致，随机程序中的前向分支会触发守卫退出。
+// 在轨迹里执行的块照样计数，各块的执行次数和回跳次数与不生成轨迹时相同
+TEST(RVTests, TestTraceDifferentialRandom) {
+    for (Engine engine : {Engine::Block, Engine::Threaded, Engine::TailCall}) {
+        SCOPED_TRACE(static_cast<int>(engine));
+        uint64_t recorded = 0, exits = 0;
+        for (uint32_t seed = 1; seed <= 10; seed++) {
+            SCOPED_TRACE(seed);
+            auto code = Rv::to_bytes(random_program(seed));
+            Cpu plain(code);
+            plain.engine = engine;
+            plain.tracing = false;
+            plain.run();
+
+            Cpu traced(code);
+            traced.engine = engine;
+            traced.trace_threshold = 1;
+            traced.run();
+            EXPECT_EQ(traced.regs, plain.regs);
+            EXPECT_EQ(traced.pc, plain.pc);
+            EXPECT_EQ(traced.instret, plain.instret);
+            for (uint64_t addr = 0x2000; addr < 0x2800; addr += 8) {
+                EXPECT_EQ(traced.load(addr, 64), plain.load(addr, 64))
+                    << addr;
+            }
+            for (const Block *block : plain.block_cache().hottest(1000)) {
+                const Block *same = traced.block_cache().find(block->start);
+                ASSERT_NE(same, nullptr) << block->start;
+                EXPECT_EQ(same->hits, block->hits) << block->start;
+                EXPECT_EQ(same->loop_hits, block->loop_hits) << block->start;
+            }
+            recorded += traced.trace_stats.recorded;
+            exits += traced.trace_stats.exits;
+        }
+        EXPECT_GT(recorded, 0);
+        EXPECT_GT(exits, 0);
+    }
+}
+
+// 循环执行到一半时改写循环体，已生成的轨迹必须随基本块一起作废
+TEST(RVTests, TestTraceSelfModifyingCode) {
+    std::vector<uint32_t> code = {
+        Rv::addi(5, 0, 100),
+        Rv::addi(9, 0, 50),
+        Rv::lui(6, 0x2f9), // x6 = addi x31, x31, 2
+        Rv::addi(6, 6, -0x6d),
+        // loop:
+        Rv::addi(31, 31, 1),
+        Rv::addi(5, 5, -1),
+        Rv::bne(5, 9, 8),
+        Rv::sw(6, 0, 16), // 改写 loop 处的指令
+        Rv::bne(5, 0, -16),
+    };
+    ASSERT_EQ(Rv::addi(31, 31, 2), 0x2f8f93u);
+    Cpu cpu(Rv::to_bytes(code));
+    cpu.trace_threshold = 1;
+    cpu.run();
+    EXPECT_EQ(cpu.regs[31], 150);
+    EXPECT_GT(cpu.trace_stats.recorded, 1);
+}
+
+// 离线翻译：静态发现的基本块入口包括分支目标、调用目标和返回地址，
+// 不包括间接跳转的目标
+TEST(RVTests, TestAotDiscover) {
+    std::vector<uint8_t> code(aot_smc_image.code,
+                              aot_smc_image.code + aot_smc_image.size);
+    EXPECT_EQ(aot_discover(code),
+              (std::vector<uint64_t>{0x0, 0xc, 0x10, 0x18, 0x48}));
+}
+
+// 离线翻译的代码与解释器结果一致；写入代码页后被改写的指令和间接跳转到的新代码交给解释器
+TEST(RVTests, TestAotFallback) {
+    std::vector<uint8_t> code(aot_smc_image.code,
+                              aot_smc_image.code + aot_smc_image.size);
+    Cpu interp(code);
+    interp.run();
+
+    Cpu cpu(code);
+    ASSERT_TRUE(cpu.attach(aot_smc_image));
+    cpu.run();
+    EXPECT_EQ(cpu.regs, interp.regs);
+    EXPECT_EQ(cpu.pc, interp.pc);
+    EXPECT_EQ(cpu.instret, interp.instret);
+    EXPECT_EQ(cpu.regs[6], 55);
+    EXPECT_EQ(cpu.regs[31], 7);
+    EXPECT_EQ(cpu.regs[27], 5);
+    EXPECT_GT(cpu.aot_instret, 0);
+    EXPECT_LT(cpu.aot_instret, cpu.instret);
+
+    // 内容与翻译时不同的镜像不能挂接
+    code[0] ^= 1;
+    Cpu other(code);
+    EXPECT_FALSE(other.attach(aot_smc_image));
+}
@@ -0,0 +1,298 @@
+#include <cstdio>
+#include <set>
+#include <sstream>
+
+#include "aot.hh"
+#include "decode.hh"
+
+namespace {
+
+// 生成代码中使用的操作名，与 Op 的枚举名相同
+#define OP_NAME(name) #name,
+constexpr const char *OP_NAMES[] = {OP_LIST(OP_NAME)};
+#undef OP_NAME
+
+std::string op_name(Op op) {
+    return std::string("Op::") + OP_NAMES[static_cast<size_t>(op)];
+}
+
+std::string hex(uint64_t v) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "0x%llx",
+                  static_cast<unsigned long long>(v));
+    return buf;
+}
+
+// 无符号64位常量
+std::string u64(uint64_t v) {
+    return hex(v) + "ull";
+}
+
+// 读寄存器，x0 直接是常量0
+std::string reg(uint8_t r) {
+    return r == 0 ? "0" : "x[" + std::to_string(r) + "]";
+}
+
+// 加载在 base 的镜像中 pc 所在的页
+uint64_t page_of(uint64_t base, uint64_t pc) {
+    return (pc - base) >> BlockCache::PAGE_SHIFT;
+}
+
+// 取出 pc 处的指令，镜像之外的 RAM 内容为0（非法指令）
+uint32_t fetch(const std::vector<uint8_t> &code, uint64_t base, uint64_t pc) {
+    uint32_t inst = 0;
+    for (uint64_t i = 0; i < 4; i++) {
+        uint64_t offset = pc - base + i;
+        if (offset < code.size()) {
+            inst |= uint32_t{code[offset]} << (8 * i);
+        }
+    }
+    return inst;
+}
+
+// 逐个基本块生成 C++ 代码
+class Emitter {
+public:
+    Emitter(const std::vector<uint8_t> &code, uint64_t base,
+            const std::set<uint64_t> &starts)
+        : code(code), base(base), starts(starts) {}
+
+    void emit_block(uint64_t start);
+
+    // 函数开头按 pc 分派到各基本块的跳转表，后面是已生成的各基本块
+    std::string str() const {
+        return dispatch() + out.str();
+    }
+
+private:
+    const std::vector<uint8_t> &code;
+    const uint64_t base;
+    const std::set<uint64_t> &starts;
+    std::ostringstream out;
+
+    // 是否生成了 jalr，间接跳转经过跳转表，这时才需要 dispatch 标号
+    bool indirect = false;
+    uint64_t block_page = 0; // 当前基本块所在的页
+    uint64_t done = 0;       // 当前基本块已经生成的指令数
+
+    static std::string label(uint64_t pc) {
+        return "L_" + hex(pc).substr(2);
+    }
+
+    // 跳到 target：已翻译的块直接 goto，跨页时先确认目标页的代码没有失效；
+    // 其他地址返回给调用者
+    std::string jump(uint64_t target) const;
+
+    // 按 pc 分派到各基本块的跳转表
+    std::string dispatch() const;
+
+    // 从当前指令退出，交给解释器从 pc 开始执行
+    std::string side_exit(uint64_t pc) const {
+        return "{ ctx->instret += " + std::to_string(done) +
+               "; ctx->side_exit = 1; return " + u64(pc) + "; }";
+    }
+
+    // 结束当前基本块，累加指令数
+    std::string retire() const {
+        return "ctx->instret += " + std::to_string(done) + "; ";
+    }
+
+    // 生成一条指令，返回它是否结束了基本块
+    bool emit_inst(uint64_t pc, const DecodedInst &d);
+};
+
+std::string Emitter::jump(uint64_t target) const {
+    if (!starts.contains(target)) {
+        return "return " + u64(target) + ";";
+    }
+    if (page_of(base, target) == block_page) {
+        return "goto " + label(target) + ";";
+    }
+    return "if (ctx->aot_pages[" + std::to_string(page_of(base, target)) +
+           "]) goto " + label(target) + "; return " + u64(target) + ";";
+}
+
+std::string Emitter::dispatch() const {
+    std::ostringstream table;
+    table << (indirect ? "dispatch:\n" : "") << "    switch (pc) {\n";
+    for (uint64_t start : starts) {
+        table << "    case " << hex(start) << ": if (ctx->aot_pages["
+              << page_of(base, start) << "]) goto " << label(start)
+              << "; return pc;\n";
+    }
+    table << "    default: return pc;\n    }\n";
+    return table.str();
+}
+
+void Emitter::emit_block(uint64_t start) {
+    block_page = page_of(base, start);
+    done = 0;
+
+    // 块内的指令数：到控制转移指令或下一个块的入口为止
+    uint64_t length = 1;
+    for (uint64_t pc = start;
+         !ends_block(decode(fetch(code, base, pc)).op) &&
+         !starts.contains(pc + 4);
+         pc += 4) {
+        length++;
+    }
+    // 剩余的指令数放不下整个块时停在入口，交给解释器逐条执行
+    out << label(start) << ":\n"
+        << "    if (ctx->instret + " << length
+        << " > ctx->budget) { ctx->side_exit = 1; return " << u64(start)
+        << "; }\n";
+    for (uint64_t pc = start;; pc += 4) {
+        if (emit_inst(pc, decode(fetch(code, base, pc)))) {
+            return;
+        }
+        // 下一条指令是另一个基本块的入口，顺序执行过去
+        if (starts.contains(pc + 4)) {
+            out << "    " << retire() << jump(pc + 4) << "\n";
+            return;
+        }
+    }
+}
+
+bool Emitter::emit_inst(uint64_t pc, const DecodedInst &d) {
+    const std::string rs1 = reg(d.rs1);
+    const std::string rs2 = reg(d.rs2);
+    const std::string imm = u64(static_cast<uint64_t>(d.imm));
+    const std::string op = op_name(d.op);
+    // 写 rd，写 x0 的结果直接丢弃
+    auto set_rd = [&d](const std::string &value) -> std::string {
+        if (d.rd == 0) {
+            return "";
+        }
+        return "x[" + std::to_string(d.rd) + "] = " + value + "; ";
+    };
+
+    out << "    ";
+    if (is_branch(d.op)) {
+        done++;
+        out << retire() << "if (taken<" << op << ">(" << rs1 << ", " << rs2
+            << ")) { " << jump(pc + d.imm) << " } " << jump(pc + 4) << "\n";
+        return true;
+    }
+    if (is_load(d.op)) {
+        out << "if (!aot_load<" << op << ">(ctx, " << rs1 << " + " << imm
+            << ", v)) " << side_exit(pc) << "\n    " << set_rd("v") << "\n";
+        done++;
+        return false;
+    }
+    if (is_store(d.op)) {
+        out << "if (!aot_store<" << op << ">(ctx, " << rs1 << " + " << imm
+            << ", " << rs2 << ")) " << side_exit(pc) << "\n";
+        done++;
+        return false;
+    }
+    if (is_alu_ri(d.op) || is_alu_rr(d.op)) {
+        out << set_rd("alu<" + op + ">(" + rs1 + ", " +
+                      (is_alu_ri(d.op) ? imm : rs2) + ")")
+            << "\n";
+        done++;
+        return false;
+    }
+    switch (d.op) {
+    case Op::Lui:
+        out << set_rd(imm) << "\n";
+        done++;
+        return false;
+    case Op::Auipc:
+        out << set_rd(u64(pc + d.imm)) << "\n";
+        done++;
+        return false;
+    case Op::Jal:
+        done++;
+        out << set_rd(u64(pc + 4)) << retire() << jump(pc + d.imm) << "\n";
+        return true;
+    case Op::Jalr:
+        // 先算出目标地址，rd 可能与 rs1 相同
+        done++;
+        indirect = true;
+        out << "pc = (" << rs1 << " + " << imm << ") & ~1ull; "
+            << set_rd(u64(pc + 4)) << retire() << "goto dispatch;\n";
+        return true;
+    default:
+        // 非法指令交给解释器进入异常
+        out << side_exit(pc) << "\n";
+        return true;
+    }
+}
+
+} // namespace
+
+std::vector<uint64_t> aot_discover(const std::vector<uint8_t> &code,
+                                   uint64_t base) {
+    auto in_image = [&code, base](uint64_t pc) {
+        return pc % 4 == 0 && pc >= base && pc - base < code.size();
+    };
+
+    std::set<uint64_t> starts;
+    std::vector<uint64_t> work{base};
+    while (!work.empty()) {
+        uint64_t start = work.back();
+        work.pop_back();
+        if (!in_image(start) || !starts.insert(start).second) {
+            continue;
+        }
+        for (uint64_t pc = start;; pc += 4) {
+            const DecodedInst d = decode(fetch(code, base, pc));
+            if (is_branch(d.op)) {
+                work.push_back(pc + d.imm);
+                work.push_back(pc + 4);
+            } else if (d.op == Op::Jal) {
+                work.push_back(pc + d.imm);
+            }
+            // 调用返回后从下一条指令继续
+            if ((d.op == Op::Jal || d.op == Op::Jalr) && d.rd != 0) {
+                work.push_back(pc + 4);
+            }
+            if (ends_block(d.op)) {
+                break;
+            }
+            // 基本块不跨页，这样一页代码失效时只需检查入口所在的页
+            if (page_of(base, pc + 4) != page_of(base, start)) {
+                work.push_back(pc + 4);
+                break;
+            }
+        }
+    }
+    return {starts.begin(), starts.end()};
+}
+
+std::string aot_translate(const std::vector<uint8_t> &code,
+                          const std::string &symbol, uint64_t base) {
+    const std::vector<uint64_t> list = aot_discover(code, base);
+    const std::set<uint64_t> starts(list.begin(), list.end());
+
+    Emitter emitter(code, base, starts);
+    for (uint64_t start : starts) {
+        emitter.emit_block(start);
+    }
+
+    std::ostringstream out;
+    out << "// 由 crvemu_aot 生成，不要手工修改\n"
+        << "#include \"aot.hh\"\n\n"
+        << "namespace {\n\n"
+        << "const uint8_t CODE[] = {";
+    for (size_t i = 0; i < code.size(); i++) {
+        out << (i % 16 == 0 ? "\n    " : " ") << static_cast<int>(code[i])
+            << ",";
+    }
+    out << "\n};\n\n"
+        << "const uint64_t STARTS[] = {";
+    for (size_t i = 0; i < list.size(); i++) {
+        out << (i % 8 == 0 ? "\n    " : " ") << hex(list[i]) << ",";
+    }
+    out << "\n};\n\n"
+        << "uint64_t run(AotContext *ctx, uint64_t pc) {\n"
+        << "    uint64_t *const x = ctx->regs;\n"
+        << "    [[maybe_unused]] uint64_t v = 0;\n"
+        << emitter.str() << "}\n\n"
+        << "} // namespace\n\n"
+        << "extern const AotImage " << symbol << ";\n"
+        << "const AotImage " << symbol
+        << " = {CODE, sizeof(CODE), STARTS, std::size(STARTS), run, "
+        << u64(base) << "};\n";
+    return out.str();
+}
@@ -0,0 +1,92 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "block.hh"
+#include "dram.hh"
+#include "param.hh"
+#include "semantics.hh"
+
+// 静态翻译的代码运行时的上下文
+struct AotContext {
+    uint64_t *regs;           // 客户机寄存器组 Cpu::regs
+    uint8_t *ram;             // DRAM 在宿主机上的起始地址
+    uint8_t *page_flags;      // 每页一个字节的标志，见 Dram::page_flags
+    const uint8_t *aot_pages; // 每页一个字节，非0表示该页的静态翻译代码仍然有效
+    uint64_t side_exit;       // 非0表示在块中间退出，返回值是未执行指令的 pc
+    uint64_t instret;         // 本次执行完成的指令数
+    uint64_t budget;          // 本次最多完成的指令数，放不下下一个块时从块入口退出
+    uint64_t ram_base;        // RAM 的客户机起始地址
+    uint64_t ram_size;        // RAM 的字节数
+};
+
+// 生成代码的入口：从 pc 处的基本块开始执行，直到跳向翻译时未发现的地址
+// （返回该地址）或从块中间退出
+using AotFn = uint64_t (*)(AotContext *ctx, uint64_t pc);
+
+// 由 crvemu_aot 离线翻译的平面二进制镜像，与生成的代码一起链接进运行程序
+struct AotImage {
+    const uint8_t *code; // 翻译时的镜像内容，加载在 base
+    size_t size;
+    const uint64_t *starts; // 已翻译的基本块入口，从小到大排列
+    size_t n_starts;
+    AotFn run;
+    uint64_t base; // 翻译时假定的 RAM 起始地址
+
+    // pc 是否是已翻译的基本块入口
+    bool covers(uint64_t pc) const {
+        return std::binary_search(starts, starts + n_starts, pc);
+    }
+};
+
+// 生成代码的访存快速路径：直接读写宿主机上的 RAM。
+// 越界、跨出 RAM 或写入含有已翻译代码的页时返回 false，由生成的代码从块中间退出，
+// 交给解释器处理异常和代码失效
+template <Op op>
+inline bool aot_load(const AotContext *ctx, uint64_t addr, uint64_t &value) {
+    using T = mem_word<op>;
+    const uint64_t offset = addr - ctx->ram_base;
+    if (offset > ctx->ram_size - sizeof(T)) {
+        return false;
+    }
+    value = load_extend<op>(host_load<T>(ctx->ram + offset));
+    return true;
+}
+
+template <Op op>
+inline bool aot_store(AotContext *ctx, uint64_t addr, uint64_t value) {
+    using T = mem_word<op>;
+    constexpr uint64_t bytes = sizeof(T);
+    const uint64_t offset = addr - ctx->ram_base;
+    if (offset > ctx->ram_size - bytes) {
+        return false;
+    }
+    // 静态翻译的代码所在的页在挂接时就标记为含有代码
+    uint8_t &first = ctx->page_flags[offset >> Dram::PAGE_SHIFT];
+    uint8_t &last = ctx->page_flags[(offset + bytes - 1) >> Dram::PAGE_SHIFT];
+    if ((first | last) & Dram::PAGE_CODE) {
+        return false;
+    }
+    host_store<T>(ctx->ram + offset, static_cast<T>(value));
+    first |= Dram::PAGE_WRITTEN;
+    last |= Dram::PAGE_WRITTEN;
+    return true;
+}
+
+// 镜像加载在 base，从 base 开始静态遍历镜像，沿顺序执行、直接跳转、分支目标和
+// 调用的返回地址找出所有可达的基本块入口，从小到大排列。
+// 间接跳转的目标在运行时才知道，交给解释器
+std::vector<uint64_t> aot_discover(const std::vector<uint8_t> &code,
+                                   uint64_t base = DRAM_BASE);
+
+// 把加载在 base 的镜像翻译成 C++ 源码，其中定义名为 symbol 的 AotImage
+std::string aot_translate(const std::vector<uint8_t> &code,
+                          const std::string &symbol,
+                          uint64_t base = DRAM_BASE);
+
+#endif
@@ -0,0 +1,37 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "aot.hh"
+
+// 离线翻译器：把平面二进制镜像（加载在 DRAM_BASE）翻译成 C++ 源码，
+// 与 aot_runner.cpp 一起编译后不再需要预热，见 CMakeLists.txt 中的 crvemu_add_aot
+int main(int argc, char *argv[]) {
+    if (argc != 3 && argc != 4) {
+        std::cout << "Usage:\n"
+                  << "- ./crvemu_aot <image.bin> <output.cpp> [symbol]\n";
+        return 0;
+    }
+    const std::string symbol = argc == 4 ? argv[3] : "aot_image";
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open file: " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> code(std::istreambuf_iterator<char>(file), {});
+    if (code.empty()) {
+        std::cerr << "Empty image: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(argv[2]);
+    out << aot_translate(code, symbol);
+    if (!out) {
+        std::cerr << "Cannot write file: " << argv[2] << std::endl;
+        return 1;
+    }
+    return 0;
+}
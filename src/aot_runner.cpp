@@ -0,0 +1,36 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "aot.hh"
+#include "cpu.hh"
+
+// 由 crvemu_aot 生成的源文件定义
+extern const AotImage aot_image;
+
+// 离线翻译的运行程序：镜像已经编译在程序里，直接从 DRAM_BASE 开始执行。
+// 运行中发现的新代码和被改写的代码交给解释器
+int main(int argc, char *argv[]) {
+    // --stats 结束时打印指令数以及其中由离线翻译的代码完成的部分
+    bool stats = argc == 2 && std::string(argv[1]) == "--stats";
+    if (argc > 2 || (argc == 2 && !stats)) {
+        std::cout << "Usage:\n"
+                  << "- ./program_name [--stats]\n";
+        return 0;
+    }
+
+    Cpu cpu(std::vector<uint8_t>(aot_image.code,
+                                 aot_image.code + aot_image.size));
+    cpu.attach(aot_image);
+    if (cpu.run() == StopReason::Trap) {
+        std::cerr << "Exception run : " << *cpu.trap << std::endl;
+    }
+
+    cpu.dump_registers();
+    cpu.dump_pc();
+    if (stats) {
+        std::cout << "Instructions retired: " << cpu.instret << " ("
+                  << cpu.aot_instret << " ahead-of-time)" << std::endl;
+    }
+    return 0;
+}
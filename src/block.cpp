@@ -0,0 +1,54 @@
+#include <algorithm>
+
+#include "block.hh"
+
+Block *BlockCache::insert(std::unique_ptr<Block> block) {
+    // 基本块不跨页，记录入口所在页即可
+    uint8_t &mark = code_pages[(block->start - ram_base) >> PAGE_SHIFT];
+    if (!mark) {
+        mark = 1;
+        n_code_pages++;
+    }
+    auto &slot = blocks[block->start];
+    slot = std::move(block);
+    return slot.get();
+}
+
+bool BlockCache::invalidate(uint64_t addr, uint64_t len) {
+    const uint64_t offset = addr - ram_base;
+    if (n_code_pages == 0 || offset >= ram_size || len > ram_size - offset) {
+        return false;
+    }
+    uint64_t first = offset >> PAGE_SHIFT;
+    uint64_t last = (offset + len - 1) >> PAGE_SHIFT;
+    for (uint64_t page = first; page <= last; page++) {
+        if (code_pages[page]) {
+            clear();
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<const Block *> BlockCache::hottest(size_t n) const {
+    std::vector<const Block *> result;
+    for (const auto &[start, block] : blocks) {
+        result.push_back(block.get());
+    }
+    auto by_hits = [](const Block *a, const Block *b) {
+        return a->hits > b->hits;
+    };
+    n = std::min(n, result.size());
+    std::partial_sort(result.begin(), result.begin() + n, result.end(),
+                      by_hits);
+    result.resize(n);
+    return result;
+}
+
+void BlockCache::clear() {
+    blocks.clear();
+    if (n_code_pages) {
+        std::fill(code_pages.begin(), code_pages.end(), 0);
+        n_code_pages = 0;
+    }
+}
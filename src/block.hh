@@ -0,0 +1,129 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "decode.hh"
+#include "param.hh"
+#include "semantics.hh"
+#include "trace.hh"
+
+// 即时编译生成的本地代码入口，见 jit.hh
+struct JitContext;
+using JitFn = uint64_t (*)(JitContext *);
+
+// 基本块：从入口开始，到第一条分支/跳转（或非法指令、页末、长度上限）为止的预解码指令序列
+struct Block {
+    // 没有对应静态后继时 succ_pc 的取值，合法的 pc 都是偶数
+    static constexpr uint64_t NO_SUCC = ~uint64_t{0};
+
+    uint64_t start = 0;
+    std::vector<DecodedInst> insts;
+
+    // 块后第一条指令的地址，(end - start) / 4 是块内的客户机指令数
+    uint64_t end = 0;
+
+    // 静态后继：[0] 为跳转目标，[1] 为顺序执行的下一条
+    // succ 是直接链接到后继块的指针，第一次走到该后继时填充
+    std::array<uint64_t, 2> succ_pc{NO_SUCC, NO_SUCC};
+    std::array<Block *, 2> succ{};
+
+    // 执行次数，达到阈值后交给即时编译器
+    uint32_t hits = 0;
+    JitFn native = nullptr;
+
+    // 以本块为目标的回跳次数，达到阈值后从这里开始记录轨迹；
+    // trace 是以本块为循环头的轨迹，随块一起失效
+    uint32_t loop_hits = 0;
+    std::unique_ptr<Trace> trace;
+
+    // 块内 pc 对应的指令下标，融合指令占两条指令的位置
+    size_t index_of(uint64_t pc) const {
+        uint64_t addr = start;
+        size_t i = 0;
+        while (addr < pc) {
+            addr += 4 * inst_count(insts[i++].op);
+        }
+        return i;
+    }
+};
+
+// 判断该指令是否结束一个基本块
+constexpr bool ends_block(Op op) {
+    switch (op) {
+    case Op::Jal:
+    case Op::Jalr:
+    case Op::Beq:
+    case Op::Bne:
+    case Op::Blt:
+    case Op::Bge:
+    case Op::Bltu:
+    case Op::Bgeu:
+    case Op::Illegal:
+    case Op::AuipcJalr:
+    case Op::SltBranch:
+    case Op::SltuBranch:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 翻译缓存：以入口 pc 索引基本块
+class BlockCache {
+public:
+    static constexpr uint64_t PAGE_SHIFT = 12;
+    static constexpr size_t MAX_BLOCK_INSTS = 64;
+
+    // 代码页按 RAM [ram_base, ram_base + ram_size) 内的页编号
+    explicit BlockCache(uint64_t ram_base = DRAM_BASE,
+                        uint64_t ram_size = DRAM_SIZE)
+        : ram_base(ram_base), ram_size(ram_size),
+          code_pages(ram_size >> PAGE_SHIFT, 0) {}
+
+    // 与预解码缓存一样是派生状态，拷贝时从空缓存开始
+    BlockCache(const BlockCache &other)
+        : BlockCache(other.ram_base, other.ram_size) {}
+    BlockCache &operator=(const BlockCache &other) {
+        return *this = BlockCache(other.ram_base, other.ram_size);
+    }
+    BlockCache(BlockCache &&) = default;
+    BlockCache &operator=(BlockCache &&) = default;
+
+    Block *find(uint64_t pc) const {
+        auto it = blocks.find(pc);
+        return it == blocks.end() ? nullptr : it->second.get();
+    }
+
+    Block *insert(std::unique_ptr<Block> block);
+
+    // 写入 [addr, addr + len) 时调用。若命中代码页则清空全部基本块
+    // （块之间的链接指针随之全部失效），返回是否发生了清空
+    bool invalidate(uint64_t addr, uint64_t len);
+
+    void clear();
+
+    // 执行次数最多的 n 个基本块，按次数从多到少排列
+    std::vector<const Block *> hottest(size_t n) const;
+
+    // RAM 的页数
+    size_t pages() const {
+        return code_pages.size();
+    }
+
+private:
+    uint64_t ram_base;
+    uint64_t ram_size;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Block>> blocks;
+
+    // 含有已翻译代码的页，以及这样的页的数量
+    std::vector<uint8_t> code_pages;
+    size_t n_code_pages = 0;
+};
+
+#endif
@@ -3,24 +3,91 @@
 
 #include "bus.hh"
 #include "param.hh"
-#include "exception.hh"
 
-Bus::Bus(const std::vector<uint8_t> &code) : dram(code) {}
+namespace {
 
-std::optional<uint64_t> Bus::load(uint64_t addr, uint64_t size) {
+const MachineConfig &checked(const MachineConfig &machine) {
+    if (auto error = machine.check()) {
+        throw std::invalid_argument(*error);
+    }
+    return machine;
+}
+
+} // namespace
+
+Bus::Bus(const MachineConfig &machine, const std::vector<uint8_t> &code,
+         HugePages huge)
+    : config(checked(machine)), dram(config, code, huge) {}
+
+Bus::Bus(const MachineConfig &machine, std::shared_ptr<const GuestImage> image,
+         HugePages huge)
+    : config(checked(machine)), dram(config, std::move(image), huge) {}
+
+std::expected<uint64_t, Exception> Bus::load(uint64_t addr, uint64_t size) {
     // 首先要检验地址是否合法随后调用 Dram 的方法
-    if (addr >= DRAM_BASE && addr <= DRAM_END) {
+    if (config.in_ram(addr)) {
         return dram.load(addr, size);
-    } else {
-        throw Exception(Exception::Type::LoadAccessFault, addr);
-        return std::nullopt;
     }
+    if (const Window *w = window_at(addr, size / 8)) {
+        if (auto value = w->device->load(addr - w->base, size)) {
+            return value.value();
+        }
+    }
+    return std::unexpected(Exception(Exception::Type::LoadAccessFault, addr));
+}
+
+std::expected<void, Exception> Bus::store(uint64_t addr, uint64_t size,
+                                          uint64_t value) {
+    if (config.in_ram(addr)) {
+        return dram.store(addr, size, value);
+    }
+    if (const Window *w = window_at(addr, size / 8)) {
+        if (w->device->store(addr - w->base, size, value)) {
+            return {};
+        }
+    }
+    return std::unexpected(
+        Exception(Exception::Type::StoreAMOAccessFault, addr));
 }
 
-void Bus::store(uint64_t addr, uint64_t size, uint64_t value) {
-    if (addr >= DRAM_BASE && addr <= DRAM_END) {
-        dram.store(addr, size, value);
-    } else {
-        throw Exception(Exception::Type::StoreAMOAccessFault, addr);
+bool Bus::attach(const std::string &name, std::shared_ptr<Device> device) {
+    const DeviceWindow *window = nullptr;
+    for (const DeviceWindow &w : config.devices) {
+        if (w.name == name) {
+            window = &w;
+        }
+    }
+    if (window == nullptr || device == nullptr ||
+        window->base + window->size > MMIO_LIMIT ||
+        windows.size() == UINT16_MAX) {
+        return false;
     }
-}
\ No newline at end of file
+    // 窗口按页对齐（见 MachineConfig::check）。窗口涉及的页必须都还空着，
+    // 已经挂了设备的页不覆盖
+    const uint64_t first = window->base >> PAGE_SHIFT;
+    const uint64_t last = (window->base + window->size - 1) >> PAGE_SHIFT;
+    for (uint64_t page = first; page <= last; page++) {
+        const uint64_t chunk = page >> (CHUNK_SHIFT - PAGE_SHIFT);
+        if (chunk < directory.size() && directory[chunk] != 0 &&
+            leaves[directory[chunk] - 1][page & (LEAF_ENTRIES - 1)] != 0) {
+            return false;
+        }
+    }
+    windows.push_back({device.get(), window->base, window->size});
+    devices.push_back(std::move(device));
+    const uint64_t chunks = (last >> (CHUNK_SHIFT - PAGE_SHIFT)) + 1;
+    if (directory.size() < chunks) {
+        directory.resize(chunks, 0);
+    }
+    for (uint64_t page = first; page <= last; page++) {
+        uint32_t &leaf = directory[page >> (CHUNK_SHIFT - PAGE_SHIFT)];
+        if (leaf == 0) {
+            leaves.emplace_back();
+            leaves.back().fill(0);
+            leaf = static_cast<uint32_t>(leaves.size());
+        }
+        leaves[leaf - 1][page & (LEAF_ENTRIES - 1)] =
+            static_cast<uint16_t>(windows.size());
+    }
+    return true;
+}
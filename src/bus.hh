@@ -1,19 +1,176 @@
 #ifndef BUS_H
 #define BUS_H
 
+#include <array>
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include "device.hh"
 #include "dram.hh"
 
+// 总线按机器描述（MachineConfig）把地址分到 RAM 和各设备窗口。
+// RAM 只比较一次；其余地址查两级的页表找到设备，查找的代价与设备数量无关
 class Bus {
 public:
-    Bus(const std::vector<uint8_t>& code);
+    // 设备窗口必须位于这个地址之下，页表的目录最多 2048 项
+    static constexpr uint64_t MMIO_LIMIT = uint64_t{1} << 32;
+
+    // machine 不合法时抛出 std::invalid_argument，见 MachineConfig::check
+    Bus(const MachineConfig &machine, const std::vector<uint8_t> &code,
+        HugePages huge = HugePages::Off);
+
+    // 以写时复制的方式映射共享镜像，见 GuestImage
+    Bus(const MachineConfig &machine, std::shared_ptr<const GuestImage> image,
+        HugePages huge = HugePages::Off);
+
+    // 使用默认机器的布局
+    Bus(const std::vector<uint8_t> &code, HugePages huge = HugePages::Off)
+        : Bus(MachineConfig{}, code, huge) {}
+    Bus(std::shared_ptr<const GuestImage> image,
+        HugePages huge = HugePages::Off)
+        : Bus(MachineConfig{}, std::move(image), huge) {}
+
+    const MachineConfig &machine() const {
+        return config;
+    }
+
+    // 把设备挂到机器描述中名为 name 的窗口上，之后落在窗口里的访问都交给它。
+    // 在启动时调用；窗口不存在、已经挂了设备或超出 MMIO_LIMIT 时返回 false。
+    // 复制 Bus 时设备是共享的
+    bool attach(const std::string &name, std::shared_ptr<Device> device);
+
+    // addr 所在页上挂的设备，没有时返回空指针
+    Device *device_at(uint64_t addr) const {
+        const Window *w = window_at(addr, 1);
+        return w != nullptr ? w->device : nullptr;
+    }
+
+    // 访问不存在的地址时返回 LoadAccessFault / StoreAMOAccessFault
+    template <MemWord T> std::expected<T, Exception> load(uint64_t addr) const {
+        if (config.in_ram(addr)) {
+            return dram.load<T>(addr);
+        }
+        if (const Window *w = window_at(addr, sizeof(T))) {
+            if (auto value = w->device->load(addr - w->base, sizeof(T) * 8)) {
+                return static_cast<T>(value.value());
+            }
+        }
+        return std::unexpected(
+            Exception(Exception::Type::LoadAccessFault, addr));
+    }
+
+    template <MemWord T>
+    std::expected<void, Exception> store(uint64_t addr, T value) {
+        if (config.in_ram(addr)) {
+            return dram.store<T>(addr, value);
+        }
+        if (const Window *w = window_at(addr, sizeof(T))) {
+            if (w->device->store(addr - w->base, sizeof(T) * 8, value)) {
+                return {};
+            }
+        }
+        return std::unexpected(
+            Exception(Exception::Type::StoreAMOAccessFault, addr));
+    }
+
+    // 按运行时给出的位数访存
+    std::expected<uint64_t, Exception> load(uint64_t addr, uint64_t size);
+    std::expected<void, Exception> store(uint64_t addr, uint64_t size,
+                                         uint64_t value);
+
+    // RAM 在宿主机上的映射：客户机地址 [ram_base(), ram_base() + ram_size())
+    // 对应从 ram() 开始的宿主机内存。CPU 和即时编译的代码对这段地址直接访问，
+    // 只有落在外面的地址才经过 load/store 的慢速路径
+    uint8_t *ram() {
+        return dram.data();
+    }
+    uint64_t ram_base() const {
+        return dram.base();
+    }
+    uint64_t ram_size() const {
+        return dram.size();
+    }
+
+    // 直接写入 ram() 之后标记写过的页并返回它们原来的标志，
+    // 以及供生成的代码直接检查和标记的页标志，见 Dram::touch 和 Dram::page_flags
+    uint8_t touch(uint64_t offset, uint64_t len) {
+        return dram.touch(offset, len);
+    }
+    uint8_t *page_flags() {
+        return dram.page_flags();
+    }
+    size_t touched_pages() const {
+        return dram.touched_pages();
+    }
+
+    // 脏页：上次 clear_dirty 以来写过的 RAM 页，见 Dram::dirty_pages
+    std::vector<uint64_t> dirty_pages() const {
+        return dram.dirty_pages();
+    }
+    bool dirty(uint64_t addr) const {
+        return dram.dirty(addr);
+    }
+    void clear_dirty() {
+        dram.clear_dirty();
+    }
+
+    // 含有预解码或翻译过的代码的页，写入这些页时 CPU 要让代码失效，见 Dram::PAGE_CODE
+    void mark_code(uint64_t addr) {
+        dram.mark_code(addr);
+    }
+    bool has_code(uint64_t addr) const {
+        return dram.has_code(addr);
+    }
+    void clear_code(uint64_t addr, uint64_t len) {
+        dram.clear_code(addr, len);
+    }
+
+    // RAM 实际得到的页大小和由大页承载的字节数，见 Dram::huge_page_bytes
+    HugePages huge_pages() const {
+        return dram.huge_pages();
+    }
+    uint64_t huge_page_bytes() const {
+        return dram.huge_page_bytes();
+    }
 
-    std::optional<uint64_t> load(uint64_t addr, uint64_t size);
-    void store(uint64_t addr, uint64_t size, uint64_t value);
-    
 private:
+    // 挂了设备的窗口
+    struct Window {
+        Device *device;
+        uint64_t base;
+        uint64_t size;
+    };
+
+    static constexpr unsigned PAGE_SHIFT = 12;
+    // 目录的每项管 2MiB，指向一张 512 项的页表；页表项是 windows 的下标加1，0 表示没有设备
+    static constexpr unsigned CHUNK_SHIFT = 21;
+    static constexpr uint64_t LEAF_ENTRIES =
+        uint64_t{1} << (CHUNK_SHIFT - PAGE_SHIFT);
+    using Leaf = std::array<uint16_t, LEAF_ENTRIES>;
+
+    // 从 addr 开始的 bytes 个字节所在的窗口，没有设备或越出窗口时返回空指针
+    const Window *window_at(uint64_t addr, uint64_t bytes) const {
+        const uint64_t chunk = addr >> CHUNK_SHIFT;
+        if (chunk >= directory.size() || directory[chunk] == 0) {
+            return nullptr;
+        }
+        const uint16_t slot = leaves[directory[chunk] - 1]
+                                    [(addr >> PAGE_SHIFT) & (LEAF_ENTRIES - 1)];
+        if (slot == 0) {
+            return nullptr;
+        }
+        const Window &w = windows[slot - 1];
+        return addr - w.base <= w.size - bytes ? &w : nullptr;
+    }
+
+    MachineConfig config;
     Dram dram;
+    // 目录按地址的 2MiB 块编号，存 leaves 的下标加1；只覆盖到最高的设备窗口
+    std::vector<uint32_t> directory;
+    std::vector<Leaf> leaves;
+    std::vector<Window> windows;
+    std::vector<std::shared_ptr<Device>> devices;
 };
 
 #endif
\ No newline at end of file
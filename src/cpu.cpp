@@ -1,84 +1,591 @@
+#include <cstring>
 #include <fstream>
 #include <iomanip> // 用于格式化输出
 #include <iostream>
 #include <optional>
 
 #include "cpu.hh"
-#include "exception.hh"
+#include "semantics.hh"
 
 std::optional<uint64_t> Cpu::load(uint64_t addr, uint64_t size) {
-    try {
-        return bus.load(addr, size);
-    } catch (const Exception &e) {
-        std::cerr << "Exception load: " << e << std::endl;
+    switch (size) {
+    case 8:
+        return load<uint8_t>(addr);
+    case 16:
+        return load<uint16_t>(addr);
+    case 32:
+        return load<uint32_t>(addr);
+    case 64:
+        return load<uint64_t>(addr);
+    default:
+        trap = Exception(Exception::Type::LoadAccessFault, addr);
         return std::nullopt;
     }
 }
 
-void Cpu::store(uint64_t addr, uint64_t size, uint64_t value) {
-    try {
-        bus.store(addr, size, value);
-    } catch (const Exception &e) {
-        std::cerr << "Exception store: " << e << std::endl;
+bool Cpu::store(uint64_t addr, uint64_t size, uint64_t value) {
+    switch (size) {
+    case 8:
+        return store<uint8_t>(addr, value);
+    case 16:
+        return store<uint16_t>(addr, value);
+    case 32:
+        return store<uint32_t>(addr, value);
+    case 64:
+        return store<uint64_t>(addr, value);
+    default:
+        trap = Exception(Exception::Type::StoreAMOAccessFault, addr);
+        return false;
     }
 }
 
+void Cpu::written(uint64_t addr, uint64_t len) {
+    // 写入可能修改了已经预解码的代码
+    icache.invalidate(addr, len);
+    if (blocks.invalidate(addr, len)) {
+        // 生成的代码互相链接，也记着基本块的地址，随基本块一起作废
+        code_modified = true;
+        jit.reset();
+    }
+    // 离线翻译的代码在生成时就固定了，被改写的页只能交给解释器
+    if (!aot_pages.empty()) {
+        for (uint64_t a = addr; a < addr + len; a++) {
+            const uint64_t offset = a - bus.ram_base();
+            if (offset < bus.ram_size()) {
+                aot_pages[offset >> BlockCache::PAGE_SHIFT] = 0;
+            }
+        }
+    }
+    bus.clear_code(addr, len);
+}
+
 std::optional<uint32_t> Cpu::fetch() {
-    try {
-        auto inst = bus.load(pc, 32);
-        if(inst.has_value()) {
-            return inst.value();
-        }
-        throw Exception(Exception::Type::InstructionAccessFault, pc);
-    } catch (const Exception &e) {
-        std::cerr << "Exception fetch: " << e << std::endl;
+    auto inst = pc % 4 == 0 ? fetch_at(pc) : std::nullopt;
+    if (!inst.has_value()) {
+        trap = fetch_fault(pc);
         return std::nullopt;
     }
+    return inst.value();
+}
+
+bool Cpu::enter_trap() {
+    mepc = pc;
+    mcause = trap->getCode();
+    mtval = trap->getValue();
+    if (trace_enabled(TraceLevel::Trap)) {
+        trace_sink->write({pc, instret, mtval, TraceRecord::Trap,
+                           static_cast<uint32_t>(mcause)});
+    }
+    if (mtvec == 0) {
+        return false;
+    }
+    pc = mtvec & ~uint64_t{3};
+    return true;
 }
 
 std::optional<uint64_t> Cpu::execute(uint32_t inst) {
-    try {
-        // decode, 按照RV手册解码指令
-        uint32_t opcode = inst & 0x7f;
-        uint32_t rd = (inst >> 7) & 0x1f;
-        uint32_t rs1 = (inst >> 15) & 0x1f;
-        uint32_t rs2 = (inst >> 20) & 0x1f;
-        uint32_t funct3 = (inst >> 12) & 0x7;
-        uint32_t funct7 = (inst >> 25) & 0x7f;
-
-        // 按照手册解释指令语义，改变状态机
-        // x0是zero寄存器，始终为0
-        regs[0] = 0;
-
-        // debug
-        std::cout << "Executing instruction: 0x" << std::hex << inst << std::dec
-                  << std::endl;
+    return execute(sink_x0(decode(inst)));
+}
+
+std::optional<uint64_t> Cpu::step() {
+    // 按值传递：执行 store 时可能使当前代码页失效
+    auto inst = fetch_decoded(pc);
+    if (!inst.has_value()) {
+        trap = fetch_fault(pc);
+        return std::nullopt;
+    }
+    return execute(inst.value());
+}
+
+std::optional<DecodedInst> Cpu::fetch_decoded(uint64_t addr) {
+    // 预解码缓存按4字节编号，不对齐的地址会取到相邻指令的缓存项
+    if (addr % 4 != 0) {
+        return std::nullopt;
+    }
+    DecodedInst &slot = icache.slot(addr);
+    if (slot.op == Op::Undecoded) {
+        auto inst = fetch_at(addr);
+        if (!inst.has_value()) {
+            return std::nullopt;
+        }
+        slot = predecode(inst.value());
+        bus.mark_code(addr);
+    }
+    return slot;
+}
+
+Block *Cpu::translate(uint64_t start) {
+    auto block = std::make_unique<Block>();
+    block->start = start;
+
+    auto same_page = [start](uint64_t addr) {
+        return (addr >> BlockCache::PAGE_SHIFT) ==
+               (start >> BlockCache::PAGE_SHIFT);
+    };
+
+    uint64_t addr = start;
+    while (true) {
+        auto inst = fetch_decoded(addr);
+        if (!inst.has_value()) {
+            break;
+        }
+        // 与下一条指令融合，两条指令必须在同一页内
+        if (fusion && !ends_block(inst->op) && same_page(addr + 4)) {
+            if (auto next = fetch_decoded(addr + 4)) {
+                if (auto fused = fuse(inst.value(), next.value())) {
+                    inst = fused;
+                    fusion_stats.translated[FusionStats::kind(inst->op)]++;
+                }
+            }
+        }
+        block->insts.push_back(inst.value());
+        addr += 4 * inst_count(inst->op);
+        if (ends_block(inst->op) ||
+            block->insts.size() == BlockCache::MAX_BLOCK_INSTS ||
+            !same_page(addr)) {
+            break;
+        }
+    }
+    if (block->insts.empty()) {
+        trap = fetch_fault(start);
+        return nullptr;
+    }
+    block->end = addr;
+
+    // 记录静态后继，jalr 是间接跳转，只能回到调度器查找
+    const DecodedInst &last = block->insts.back();
+    uint64_t last_pc = addr - 4 * inst_count(last.op);
+    switch (last.op) {
+    case Op::Jal:
+        block->succ_pc[0] = last_pc + last.imm;
+        break;
+    case Op::AuipcJalr:
+        // auipc + jalr 的目标地址是静态可知的
+        block->succ_pc[0] = (last_pc + last.imm + last.imm2) & ~uint64_t{1};
+        break;
+    case Op::Jalr:
+    case Op::Illegal:
+        break;
+    case Op::Beq:
+    case Op::Bne:
+    case Op::Blt:
+    case Op::Bge:
+    case Op::Bltu:
+    case Op::Bgeu:
+    case Op::SltBranch:
+    case Op::SltuBranch:
+        block->succ_pc[0] = last_pc + last.imm;
+        block->succ_pc[1] = addr;
+        break;
+    default:
+        block->succ_pc[1] = addr;
+        break;
+    }
+    return blocks.insert(std::move(block));
+}
+
+bool Cpu::run_block(const Block &block, size_t first) {
+    for (size_t i = first; i < block.insts.size(); i++) {
+        const DecodedInst inst = block.insts[i];
+        auto next_pc = exec(inst);
+        if (!next_pc.has_value()) {
+            return false;
+        }
+        pc = next_pc.value();
+        instret += inst_count(inst.op);
+        // 当前块已经被清空，不能再访问 block
+        if (code_modified) {
+            return true;
+        }
+    }
+    return true;
+}
+
+bool Cpu::run_steps(const Block &block, uint64_t limit, uint64_t breakpoint) {
+    while (instret < limit) {
+        auto inst = fetch_decoded(pc);
+        if (!inst.has_value()) {
+            trap = fetch_fault(pc);
+            return false;
+        }
+        auto next_pc = exec(inst.value());
+        if (!next_pc.has_value()) {
+            return false;
+        }
+        if (trace_enabled(TraceLevel::Inst)) {
+            trace_sink->write({pc, instret, inst->raw, TraceRecord::Inst, 1});
+        }
+        pc = next_pc.value();
+        instret++;
+        if (code_modified || ends_block(inst->op) || pc == block.end ||
+            pc == breakpoint) {
+            return true;
+        }
+    }
+    return true;
+}
+
+bool Cpu::attach(const AotImage &image) {
+    if (image.base != bus.ram_base() || image.size > bus.ram_size() ||
+        std::memcmp(bus.ram(), image.code, image.size) != 0) {
+        return false;
+    }
+    aot = &image;
+    aot_pages.assign(blocks.pages(), 0);
+    for (size_t i = 0; i < image.n_starts; i++) {
+        aot_pages[(image.starts[i] - image.base) >> BlockCache::PAGE_SHIFT] = 1;
+        bus.mark_code(image.starts[i]);
+    }
+    return true;
+}
+
+bool Cpu::run_aot(uint64_t limit) {
+    AotContext ctx{regs.data(), bus.ram(), bus.page_flags(), aot_pages.data(),
+                   0, 0, limit - instret, bus.ram_base(), bus.ram_size()};
+    pc = aot->run(&ctx, pc);
+    instret += ctx.instret;
+    aot_instret += ctx.instret;
+    return ctx.side_exit != 0;
+}
+
+bool Cpu::run_native(const Block &block, uint64_t limit,
+                     uint64_t &last_start) {
+    JitContext ctx{regs.data(), bus.ram(), bus.page_flags(),
+                   bus.ram_size() - 7, 0, 0, limit - instret};
+    pc = block.native(&ctx);
+    instret += ctx.instret;
+    last_start = ctx.last;
+    if (ctx.indirect) {
+        jit.link_indirect(reinterpret_cast<uint8_t *>(ctx.indirect), pc);
+    }
+    // 本地代码之间直接链接，中途退出的可能是后面的块
+    if (ctx.side_exit) {
+        const Block &exited = *reinterpret_cast<const Block *>(ctx.side_exit);
+        return run_block(exited, exited.index_of(pc));
+    }
+    return true;
+}
+
+Block *Cpu::maybe_compile(Block *block) {
+    if (block->hits != jit_threshold) {
+        return block;
+    }
+    if (jit.full()) {
+        // 代码缓冲区满了：丢弃全部生成的代码和基本块，重新开始
+        jit.reset();
+        blocks.clear();
+        block = translate(pc);
+        if (block == nullptr) {
+            return nullptr;
+        }
+    }
+    block->native = jit.compile(*block, bus.ram_base(), jit_regalloc);
+    return block;
+}
+
+void Cpu::record(Block *block) {
+    if (!recording.empty() && block == recording.front()) {
+        // 回到了循环头，路径闭合
+        block->trace = make_trace(recording);
+        trace_stats.recorded++;
+        recording.clear();
+    } else if (recording.size() == Trace::MAX_BLOCKS) {
+        // 循环太长，过一段时间再从头试一次
+        recording.front()->loop_hits = 0;
+        trace_stats.aborted++;
+        recording.clear();
+    } else {
+        recording.push_back(block);
+    }
+}
 
-        switch (opcode) {
-        case 0x13: { // addi
-            int64_t imm = static_cast<int32_t>(inst & 0xfff00000) >> 20;
-            regs[rd] = regs[rs1] + imm;
+bool Cpu::run_trace(const Trace &trace, uint64_t limit, uint64_t &last_start) {
+    trace_stats.entered++;
+    TraceExit exit;
+    const bool ok = run_trace_threaded(trace, limit, exit);
+    // 写入代码页时轨迹随基本块一起被清空，计数也不再有意义
+    if (!code_modified) {
+        last_start = trace.account(exit);
+    }
+    return ok;
+}
 
-            // debug
-            std::cout << "ADDI: x" << rd << " = x" << rs1 << " + " << imm
-                      << std::endl;
-            return update_pc();
+bool Cpu::run_trace_switch(const Trace &trace, uint64_t limit,
+                           TraceExit &exit) {
+    size_t i = 0;
+    while (true) {
+        const DecodedInst inst = trace.insts[i];
+        exit.last = i;
+        auto next_pc = exec(inst);
+        if (!next_pc.has_value()) {
+            return false;
+        }
+        pc = next_pc.value();
+        instret += inst_count(inst.op);
+        if (code_modified) {
+            return true;
+        }
+        // 轨迹末尾接回循环头。顺序执行的指令走向是确定的，只有块末的控制转移需要守卫
+        if (++i == trace.insts.size()) {
+            i = 0;
+        }
+        if (ends_block(inst.op) && pc != trace.pcs[i]) {
+            trace_stats.exits++;
+            return true;
         }
-        case 0x33: { // add
-            regs[rd] = regs[rs1] + regs[rs2];
-            // debug
-            std::cout << "ADD: x" << rd << " = x" << rs1 << " + x" << rs2
-                      << std::endl;
-            return update_pc();
+        if (i == 0) {
+            if (instret + trace.length > limit) {
+                return true;
+            }
+            exit.wraps++;
         }
-        default:
-            // 抛出自定义异常
-            throw Exception(Exception::Type::IllegalInstruction, opcode);
+    }
+}
+
+StopReason Cpu::run_until(uint64_t breakpoint, uint64_t max_insts) {
+    recording.clear();
+    // 停下时的 instret
+    const uint64_t limit =
+        max_insts > UINT64_MAX - instret ? UINT64_MAX : instret + max_insts;
+    const bool log_insts = trace_enabled(TraceLevel::Inst);
+    const bool stepping = breakpoint != NO_BREAKPOINT || log_insts;
+    Block *block = nullptr;
+    uint64_t last_start = Block::NO_SUCC; // 上一个执行的块的入口
+    bool aot_exit = false; // 刚从离线翻译的代码中途退出，下一个块必须解释执行
+    while (true) {
+        if (pc == breakpoint) {
+            return StopReason::Breakpoint;
+        }
+        if (instret >= limit) {
+            return StopReason::Budget;
+        }
+
+        // 有离线翻译的代码时优先执行，回来时 pc 已经是翻译时不可知的地址
+        if (!aot_exit && !stepping && aot_covers(pc)) {
+            aot_exit = run_aot(limit);
+            block = nullptr;
+            last_start = Block::NO_SUCC;
+            continue;
+        }
+        aot_exit = false;
+
+        // 调度器：只有间接跳转、首次执行或缓存被清空时才会进入
+        if (block == nullptr) {
+            block = blocks.find(pc);
+            if (block == nullptr) {
+                block = translate(pc);
+            }
+            if (block == nullptr) {
+                if (!enter_trap()) {
+                    return StopReason::Trap;
+                }
+                continue;
+            }
+        }
+
+        // 热点探测：统计每个块的执行次数，跳到不在上一个块之后的位置算作回跳，
+        // 计入目标块（循环头）。计数常开，循环头足够热时开始记录轨迹。
+        // 解释执行的引擎都把轨迹交给线索化核心，即时编译的引擎按块编译
+        block->hits++;
+        if (last_start != Block::NO_SUCC && pc <= last_start &&
+            ++block->loop_hits >= trace_threshold && recording.empty() &&
+            !block->trace && tracing && engine != Engine::Jit) {
+            record(block);
+        } else if (!recording.empty()) {
+            record(block);
+        }
+        last_start = block->start;
+        if (trace_enabled(TraceLevel::Block)) {
+            trace_sink->write(
+                {pc, instret, block->end, TraceRecord::Block, 0});
+        }
+
+        if (engine == Engine::Jit && block->native == nullptr) {
+            block = maybe_compile(block);
+            if (block == nullptr) {
+                if (!enter_trap()) {
+                    return StopReason::Trap;
+                }
+                continue;
+            }
         }
 
-    } catch (const Exception &e) {
-        std::cerr << "Exception execute : " << e << std::endl;
-        return std::nullopt; // 使用 std::optional 表示异常
+        code_modified = false;
+        bool ok = false;
+        if ((block->end - block->start) / 4 > limit - instret ||
+            (breakpoint > block->start && breakpoint < block->end) ||
+            log_insts) {
+            // 上限或断点落在块内，逐条执行到那里；记录每条指令时总是逐条执行
+            recording.clear();
+            ok = run_steps(*block, limit, breakpoint);
+            if (!ok && !enter_trap()) {
+                return StopReason::Trap;
+            }
+            block = nullptr;
+            continue;
+        } else if (block->trace && recording.empty() && tracing &&
+                   !stepping && block->trace->length <= limit - instret) {
+            ok = run_trace(*block->trace, limit, last_start);
+        } else if (block->native && !stepping) {
+            ok = run_native(*block, limit, last_start);
+        } else if (engine == Engine::Threaded) {
+            ok = run_block_threaded(*block);
+        } else if (engine == Engine::TailCall) {
+            ok = run_block_tailcall(*block);
+        } else {
+            ok = run_block(*block);
+        }
+        if (!ok) {
+            // 进入异常处理程序，它的入口由调度器查找
+            if (!enter_trap()) {
+                return StopReason::Trap;
+            }
+            recording.clear();
+            block = nullptr;
+            continue;
+        }
+        if (code_modified) {
+            // 基本块已被清空，生成的代码和轨迹也随之作废
+            recording.clear();
+            block = nullptr;
+            continue;
+        }
+
+        // 沿着静态后继直接链接到下一个块
+        Block *prev = block;
+        block = nullptr;
+        for (size_t i = 0; i < prev->succ_pc.size(); i++) {
+            if (prev->succ_pc[i] == pc) {
+                if (prev->succ[i] == nullptr) {
+                    prev->succ[i] = blocks.find(pc);
+                    if (prev->succ[i] == nullptr) {
+                        prev->succ[i] = translate(pc);
+                    }
+                }
+                block = prev->succ[i];
+                break;
+            }
+        }
+    }
+}
+
+std::optional<uint64_t> Cpu::execute(DecodedInst inst) {
+    auto next_pc = exec(inst);
+    if (next_pc.has_value()) {
+        if (trace_enabled(TraceLevel::Inst)) {
+            trace_sink->write({pc, instret, inst.raw, TraceRecord::Inst,
+                               static_cast<uint32_t>(inst_count(inst.op))});
+        }
+        instret += inst_count(inst.op);
+        return next_pc;
+    }
+    if (enter_trap()) {
+        return pc;
+    }
+    return std::nullopt; // 使用 std::optional 表示异常
+}
+
+std::optional<uint64_t> Cpu::exec(DecodedInst inst) {
+    // 按照手册解释指令语义，改变状态机。写 x0 的指令在预解码时已经改为写丢弃槽位
+    const uint64_t rs1 = regs[inst.rs1];
+    const uint64_t rs2 = regs[inst.rs2];
+    const auto imm = static_cast<uint64_t>(inst.imm);
+
+    switch (inst.op) {
+    case Op::Lui:
+        regs[inst.rd] = imm;
+        return update_pc();
+    case Op::Auipc:
+        regs[inst.rd] = pc + imm;
+        return update_pc();
+    case Op::Jal:
+        regs[inst.rd] = pc + 4;
+        return pc + imm;
+    case Op::Jalr:
+        regs[inst.rd] = pc + 4;
+        return (rs1 + imm) & ~uint64_t{1};
+
+#define BRANCH(name)                                                           \
+    case Op::name:                                                             \
+        return taken<Op::name>(rs1, rs2) ? pc + imm : update_pc();
+        BRANCH_OPS(BRANCH)
+#undef BRANCH
+
+#define LOAD(name)                                                             \
+    case Op::name: {                                                           \
+        auto value = load<mem_word<Op::name>>(rs1 + imm);                      \
+        if (!value.has_value()) {                                              \
+            return std::nullopt;                                               \
+        }                                                                      \
+        regs[inst.rd] = load_extend<Op::name>(value.value());                  \
+        return update_pc();                                                    \
+    }
+        LOAD_OPS(LOAD)
+#undef LOAD
+
+#define STORE(name)                                                            \
+    case Op::name:                                                             \
+        if (!store<mem_word<Op::name>>(rs1 + imm, rs2)) {                      \
+            return std::nullopt;                                               \
+        }                                                                      \
+        return update_pc();
+        STORE_OPS(STORE)
+#undef STORE
+
+#define ALU_RI(name)                                                           \
+    case Op::name:                                                             \
+        regs[inst.rd] = alu<Op::name>(rs1, imm);                               \
+        return update_pc();
+        ALU_RI_OPS(ALU_RI)
+#undef ALU_RI
+
+#define ALU_RR(name)                                                           \
+    case Op::name:                                                             \
+        regs[inst.rd] = alu<Op::name>(rs1, rs2);                               \
+        return update_pc();
+        ALU_RR_OPS(ALU_RR)
+#undef ALU_RR
+
+    // 融合指令，执行效果与依次执行原来的两条指令相同
+    case Op::LuiAddi:
+        regs[inst.rd] = imm;
+        fusion_stats.executed[FusionStats::kind(inst.op)]++;
+        return pc + 8;
+    case Op::AuipcJalr:
+        regs[inst.rs1] = pc + imm;
+        regs[inst.rd] = pc + 8;
+        fusion_stats.executed[FusionStats::kind(inst.op)]++;
+        return (pc + imm + inst.imm2) & ~uint64_t{1};
+    case Op::AuipcLd: {
+        regs[inst.rs1] = pc + imm;
+        auto value = load<uint64_t>(pc + imm + inst.imm2);
+        if (!value.has_value()) {
+            // auipc 已经完成，停在出错的 ld 上，这一对不算执行过
+            pc += 4;
+            instret++;
+            return std::nullopt;
+        }
+        regs[inst.rd] = value.value();
+        fusion_stats.executed[FusionStats::kind(inst.op)]++;
+        return pc + 8;
+    }
+    case Op::SlliSrli:
+        regs[inst.rd] = (rs1 << imm) >> inst.imm2;
+        fusion_stats.executed[FusionStats::kind(inst.op)]++;
+        return pc + 8;
+    case Op::SltBranch:
+    case Op::SltuBranch: {
+        uint64_t cond = inst.op == Op::SltBranch ? alu<Op::Slt>(rs1, rs2)
+                                                 : alu<Op::Sltu>(rs1, rs2);
+        regs[inst.rd] = cond;
+        fusion_stats.executed[FusionStats::kind(inst.op)]++;
+        return (cond != 0) == (inst.imm2 != 0) ? pc + imm : pc + 8;
+    }
+
+    default:
+        // 非法指令，mtval 是指令本身
+        trap = Exception(Exception::Type::IllegalInstruction, inst.raw);
+        return std::nullopt;
     }
 }
 
@@ -1,8 +1,18 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include "aot.hh"
+#include "block.hh"
 #include "bus.hh"
+#include "decode.hh"
+#include "exception.hh"
+#include "fusion.hh"
+#include "icache.hh"
+#include "jit.hh"
 #include "param.hh"
+#include "semantics.hh"
+#include "trace_sink.hh"
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <fstream>
@@ -10,36 +20,146 @@
 #include <optional>
 #include <vector>
 
+// 基本块的执行方式，可在运行时选择
+enum class Engine {
+    Block,    // 解释执行预解码的基本块（switch 分派）
+    Threaded, // 同上，但使用 computed goto 线索化分派，需开启 CRVEMU_THREADED_DISPATCH
+    TailCall, // 同上，每条指令一个处理函数，以尾调用相互衔接
+    Jit,      // 热点基本块编译为本地代码，不支持的部分回退到解释器
+};
+
+// run() / run_until() 停下来的原因
+enum class StopReason : uint8_t {
+    Trap,       // 异常或非法指令且没有设置 mtvec，pc 停在出错的指令上，见 Cpu::trap
+    Budget,     // 完成的指令数达到了上限
+    Breakpoint, // 将要执行 run_until() 指定地址处的指令
+};
+
+// 通用寄存器组：x0..x31 之后是接收写 x0 结果的丢弃槽位，见 sink_x0。
+// 丢弃槽位不属于体系结构状态，比较时忽略
+struct RegisterFile : std::array<uint64_t, REG_SLOTS> {
+    bool operator==(const RegisterFile &other) const {
+        return std::equal(begin(), begin() + 32, other.begin());
+    }
+};
+
 // 处理器定义
 class Cpu {
 public:
-    // RISC-有32个寄存器，每个寄存器64位
+    // RISC-有32个寄存器，每个寄存器64位，最后多出的 regs[ZERO_SINK] 接收写 x0 的结果
     // 当用空的 {} 进行列表初始化时，如果元素类型是基本类型（如
     // int、float、uint64_t 等），它们将被初始化为零值
-    std::array<uint64_t, 32> regs{};
+    RegisterFile regs{};
 
     // PC寄存器
     uint64_t pc;
 
+    // 已经执行完成的指令数，融合指令按两条计算
+    uint64_t instret = 0;
+
     // CPU通过总线和内存交互
     Bus bus;
 
-    Cpu(const std::vector<uint8_t> &code)
-        : pc{DRAM_BASE}, bus{code},
+    // run() 使用的执行引擎
+    Engine engine = Engine::Block;
+
+    // 基本块执行多少次后交给即时编译器，以及编译时是否分配宿主机寄存器
+    uint32_t jit_threshold = Jit::DEFAULT_THRESHOLD;
+    bool jit_regalloc = true;
+
+    // 翻译基本块时是否把常见的指令对融合为超级指令，以及融合的统计
+    bool fusion = true;
+    FusionStats fusion_stats;
+
+    // 是否把热点循环记录成轨迹交给线索化核心整体执行（用于解释执行的引擎，
+    // Engine::Jit 按块编译），以及循环头回跳多少次后开始记录
+    static constexpr uint32_t DEFAULT_TRACE_THRESHOLD = 64;
+    bool tracing = true;
+    uint32_t trace_threshold = DEFAULT_TRACE_THRESHOLD;
+    TraceStats trace_stats;
+
+    // 离线翻译的代码完成的指令数，已计入 instret
+    uint64_t aot_instret = 0;
+
+    // 机器模式的异常处理 CSR。mtvec 为0表示没有异常处理程序，异常时 run() 停下；
+    // 否则进入异常时跳到 mtvec（direct 模式）继续执行
+    uint64_t mtvec = 0;
+    uint64_t mepc = 0;
+    uint64_t mcause = 0;
+    uint64_t mtval = 0;
+
+    // 最近一次发生的异常。访存、取指和执行出错时只记录在这里并返回失败，
+    // 不抛出 C++ 异常，由 run() 在一处进入异常（见 enter_trap）
+    std::optional<Exception> trap;
+
+    // 二进制执行日志，为空时不记录。记录每条指令时不进入轨迹、本地代码和离线翻译的代码，
+    // 并且不经过融合逐条执行
+    TraceSink *trace_sink = nullptr;
+
+    // huge 选择 RAM 的宿主机页大小，见 HugePages
+    Cpu(const std::vector<uint8_t> &code, HugePages huge = HugePages::Off)
+        : Cpu(Bus{code, huge}) {}
+
+    // 从共享镜像创建，多个实例共用镜像中没有写过的页
+    Cpu(std::shared_ptr<const GuestImage> image,
+        HugePages huge = HugePages::Off)
+        : Cpu(Bus{std::move(image), huge}) {}
+
+    // 按 bus 的机器描述创建：pc 指向 RAM 的起始地址，sp 指向 RAM 的末尾
+    explicit Cpu(Bus &&bus)
+        : pc{bus.ram_base()}, bus{std::move(bus)},
+          blocks{this->bus.ram_base(), this->bus.ram_size()},
           RVABI{"zero", "ra", "sp",  "gp",  "tp", "t0", "t1", "t2",
                 "s0",   "s1", "a0",  "a1",  "a2", "a3", "a4", "a5",
                 "a6",   "a7", "s2",  "s3",  "s4", "s5", "s6", "s7",
                 "s8",   "s9", "s10", "s11", "t3", "t4", "t5", "t6"} {
         regs.fill(0); // 所有寄存器初始化为0
-        regs[2] = DRAM_SIZE -
+        regs[2] = this->bus.ram_base() + this->bus.ram_size() -
                   1; // 栈指针 (SP) 需要指向栈顶（内存的最高地址，x2即sp，栈指针
     }
 
+    // 按类型读写内存，出错时把异常记录在 trap 中，返回 std::nullopt / false。
+    // 解释器核心按指令的访存宽度实例化。落在 RAM 里的地址只比较一次就直接访问宿主机内存，
+    // 其余地址交给总线
+    template <MemWord T> std::optional<uint64_t> load(uint64_t addr) {
+        const uint64_t offset = addr - bus.ram_base();
+        if (offset <= bus.ram_size() - sizeof(T)) [[likely]] {
+            return host_load<T>(bus.ram() + offset);
+        }
+        auto value = bus.load<T>(addr);
+        if (!value.has_value()) {
+            trap = value.error();
+            return std::nullopt;
+        }
+        return value.value();
+    }
+
+    // 写入 RAM 时顺便标记脏页，只有写到含有代码的页才需要让缓存的代码失效。
+    // 跨出 RAM 末尾的写入总线会拒绝，所以经过总线成功的写入都落在设备上，与代码无关
+    template <MemWord T> bool store(uint64_t addr, uint64_t value) {
+        const uint64_t offset = addr - bus.ram_base();
+        if (offset <= bus.ram_size() - sizeof(T)) [[likely]] {
+            host_store<T>(bus.ram() + offset, static_cast<T>(value));
+            if (bus.touch(offset, sizeof(T)) & Dram::PAGE_CODE) [[unlikely]] {
+                written(addr, sizeof(T));
+            }
+            return true;
+        }
+        auto result = bus.store<T>(addr, static_cast<T>(value));
+        if (!result.has_value()) {
+            trap = result.error();
+            return false;
+        }
+        return true;
+    }
+
+    // 按运行时给出的位数读写内存
     std::optional<uint64_t> load(uint64_t addr, uint64_t size);
 
-    void store(uint64_t addr, uint64_t size, uint64_t value);
+    bool store(uint64_t addr, uint64_t size, uint64_t value);
 
-    // 取出32位字长的指令
+    // 取出32位字长的指令，出错时记录 InstructionAddrMisaligned 或
+    // InstructionAccessFault
     std::optional<uint32_t> fetch();
 
     // 返回下一条指令的地址
@@ -53,10 +173,155 @@ public:
     // 打印pc
     void dump_pc() const;
 
-    // 执行当前指令，并且返回下一条指令的地址
+    // 执行当前指令，并且返回下一条指令的地址；出错且进入了异常处理程序时返回 mtvec
     std::optional<uint64_t>  execute(uint32_t inst);
 
+    // 执行一条已经解码的指令，返回下一条指令的地址，需要时写一条执行日志
+    std::optional<uint64_t> execute(DecodedInst inst);
+
+    // 通过预解码缓存取指并执行 pc 处的指令，返回下一条指令的地址
+    std::optional<uint64_t> step();
+
+    // 没有断点时 run_until() 使用的地址，合法的 pc 都是偶数
+    static constexpr uint64_t NO_BREAKPOINT = ~uint64_t{0};
+
+    // 以基本块为单位执行，直到遇到异常或非法指令，或者完成 max_insts 条指令。
+    // 直接跳转的后继块会被链接起来，上限只在块之间检查，剩余不足一个块时逐条执行，
+    // 所以停下时恰好完成 max_insts 条
+    StopReason run(uint64_t max_insts = UINT64_MAX) {
+        return run_until(NO_BREAKPOINT, max_insts);
+    }
+
+    // 同 run()，另外在将要执行 breakpoint 处的指令时停下。
+    // 有断点时不进入轨迹、本地代码和离线翻译的代码，它们内部的循环不经过检查
+    StopReason run_until(uint64_t breakpoint, uint64_t max_insts = UINT64_MAX);
+
+    // 不写执行日志的执行核心，出错时把异常记录在 trap 中并返回 std::nullopt，
+    // pc 停在出错的指令上
+    std::optional<uint64_t> exec(DecodedInst inst);
+
+    // 进入 trap 记录的异常：把 pc、异常号和附加信息写入 mepc/mcause/mtval。
+    // 设置了 mtvec 时 pc 跳到 mtvec 并返回 true，否则返回 false，由调用者停下
+    bool enter_trap();
+
+    // 挂接 crvemu_aot 离线翻译的镜像，RAM 的起始地址和开头的内容必须与翻译时一致，否则返回 false。
+    // 之后 run() 走到镜像中的基本块入口时直接执行生成的代码，写入过的代码页退回解释器
+    bool attach(const AotImage &image);
+
+    // 已翻译的基本块及其执行计数，用于找出热点
+    const BlockCache &block_cache() const {
+        return blocks;
+    }
+
 private:
+    // 预解码指令缓存
+    DecodeCache icache;
+
+    // 基本块翻译缓存
+    BlockCache blocks;
+
+    // 执行基本块期间有写入命中了代码页，当前块可能已被释放
+    bool code_modified = false;
+
+    // 写入含有代码的页 [addr, addr + len) 之后调用：丢弃涉及的预解码指令、基本块和
+    // 离线翻译的代码，并清除这些页的代码标记，直到再次从中取指
+    void written(uint64_t addr, uint64_t len);
+
+    // 解码一条指令，写 x0 的结果改为写入丢弃槽位，结果存入预解码缓存
+    DecodedInst predecode(uint32_t inst) const {
+        return sink_x0(decode(inst));
+    }
+
+    // 取出 addr 处的指令，失败时返回 std::nullopt，不记录异常。
+    // 只能从 RAM 取指：读设备寄存器有副作用，基本块缓存也只覆盖 RAM
+    std::optional<uint32_t> fetch_at(uint64_t addr) {
+        const uint64_t offset = addr - bus.ram_base();
+        if (offset <= bus.ram_size() - 4) [[likely]] {
+            return host_load<uint32_t>(bus.ram() + offset);
+        }
+        return std::nullopt;
+    }
+
+    // 通过预解码缓存取得 addr 处的指令，取指失败时返回 std::nullopt
+    std::optional<DecodedInst> fetch_decoded(uint64_t addr);
+
+    // 在 addr 处取指失败的异常：没有 C 扩展，地址必须按4字节对齐；
+    // 对齐的地址取指失败是因为不在 RAM 内
+    static Exception fetch_fault(uint64_t addr) {
+        return Exception(addr % 4 != 0
+                             ? Exception::Type::InstructionAddrMisaligned
+                             : Exception::Type::InstructionAccessFault,
+                         addr);
+    }
+
+    // 发现并翻译以 start 开头的基本块，取指失败时返回 nullptr
+    Block *translate(uint64_t start);
+
+    // 即时编译器
+    Jit jit;
+
+    // 是否要向执行日志写入 level 级别的记录，编译时关闭的级别是常量 false
+    bool trace_enabled(TraceLevel level) const {
+        return TraceSink::compiled(level) && trace_sink != nullptr &&
+               trace_sink->enabled(level);
+    }
+
+    // 从第 first 条指令开始解释执行基本块，pc 随之更新；出错时返回 false
+    bool run_block(const Block &block, size_t first = 0);
+
+    // 不经过融合，逐条执行 pc 所在的基本块，完成的指令数达到 limit
+    // 或走到 breakpoint 时提前停下；出错时返回 false。需要时每条指令写一条执行日志
+    bool run_steps(const Block &block, uint64_t limit, uint64_t breakpoint);
+
+    // 线索化分派的解释器核心，见 threaded.cpp
+    template <bool in_trace>
+    bool run_threaded(const DecodedInst *begin, const DecodedInst *end,
+                      const Trace *trace, uint64_t limit, TraceExit *exit);
+    bool run_block_threaded(const Block &block);
+
+    // 尾调用衔接的解释器核心，见 tailcall.cpp
+    friend struct TailCall;
+    bool run_block_tailcall(const Block &block);
+
+    // 执行基本块编译后的本地代码，中途退出时剩余部分交给解释器。
+    // 自循环和块之间的链接在完成的指令数超过 limit 之前退出。
+    // last_start 更新为本地代码最后进入的块，供调度器判断回跳
+    bool run_native(const Block &block, uint64_t limit, uint64_t &last_start);
+
+    // 按执行次数决定是否编译该基本块，代码缓冲区满时可能换成新翻译的块
+    Block *maybe_compile(Block *block);
+
+    // 挂接的离线翻译镜像，以及每页一个字节的有效标记，写入后该页不再使用生成的代码
+    const AotImage *aot = nullptr;
+    std::vector<uint8_t> aot_pages;
+
+    // pc 处是否有仍然有效的离线翻译代码
+    bool aot_covers(uint64_t pc) const {
+        return aot != nullptr && pc - bus.ram_base() < bus.ram_size() &&
+               aot_pages[(pc - bus.ram_base()) >> BlockCache::PAGE_SHIFT] &&
+               aot->covers(pc);
+    }
+
+    // 执行离线翻译的代码，从块中间退出（剩余部分交给解释器）时返回 true。
+    // 完成的指令数不超过 limit
+    bool run_aot(uint64_t limit);
+
+    // 正在记录的轨迹路径，第一个块是循环头；为空表示没有在记录
+    std::vector<Block *> recording;
+
+    // 记录模式下每执行一个块调用一次，回到循环头时生成轨迹
+    void record(Block *block);
+
+    // 执行轨迹，直到守卫失败、写入代码页或再走一遍会超过 limit；出错时返回 false。
+    // 调用前走一遍不能超过 limit。离开时补记轨迹中各块的计数，last_start 改为最后执行的块
+    bool run_trace(const Trace &trace, uint64_t limit, uint64_t &last_start);
+
+    // 由线索化核心执行轨迹，exit 记下离开时的位置；
+    // 未开启 CRVEMU_THREADED_DISPATCH 时由 run_trace_switch 逐条执行
+    bool run_trace_threaded(const Trace &trace, uint64_t limit,
+                            TraceExit &exit);
+    bool run_trace_switch(const Trace &trace, uint64_t limit, TraceExit &exit);
+
     // RISC-V 寄存器名称
     const std::array<std::string, 32> RVABI;
 };
@@ -0,0 +1,224 @@
+#include <array>
+#include <cstddef>
+
+#include "decode.hh"
+
+namespace {
+
+// 操作数格式，决定立即数如何提取
+enum class Format : uint8_t { R, I, S, B, U, J, Shamt6, Shamt5 };
+
+// 一条指令的编码：mask 中为1的位是固定位，取值必须等于 match
+struct InstDesc {
+    Op op;
+    Format format;
+    uint32_t mask;
+    uint32_t match;
+};
+
+constexpr uint32_t OPCODE_MASK = 0x0000007f;
+constexpr uint32_t FUNCT3_MASK = 0x0000707f; // opcode + funct3
+constexpr uint32_t FUNCT7_MASK = 0xfe00707f; // opcode + funct3 + funct7
+constexpr uint32_t FUNCT6_MASK = 0xfc00707f; // RV64 的6位移位量占用了 funct7 的最低位
+
+constexpr uint32_t enc(uint32_t opcode, uint32_t funct3 = 0,
+                       uint32_t funct7 = 0) {
+    return opcode | funct3 << 12 | funct7 << 25;
+}
+
+// 声明式的指令列表，按照RV手册列出每条指令的格式和编码，解码表在编译期由它生成。
+// 扩展指令集时只需要在这里添加一行
+constexpr InstDesc INSTS[] = {
+    {Op::Lui, Format::U, OPCODE_MASK, enc(0x37)},
+    {Op::Auipc, Format::U, OPCODE_MASK, enc(0x17)},
+    {Op::Jal, Format::J, OPCODE_MASK, enc(0x6f)},
+    {Op::Jalr, Format::I, FUNCT3_MASK, enc(0x67, 0)},
+
+    {Op::Beq, Format::B, FUNCT3_MASK, enc(0x63, 0)},
+    {Op::Bne, Format::B, FUNCT3_MASK, enc(0x63, 1)},
+    {Op::Blt, Format::B, FUNCT3_MASK, enc(0x63, 4)},
+    {Op::Bge, Format::B, FUNCT3_MASK, enc(0x63, 5)},
+    {Op::Bltu, Format::B, FUNCT3_MASK, enc(0x63, 6)},
+    {Op::Bgeu, Format::B, FUNCT3_MASK, enc(0x63, 7)},
+
+    {Op::Lb, Format::I, FUNCT3_MASK, enc(0x03, 0)},
+    {Op::Lh, Format::I, FUNCT3_MASK, enc(0x03, 1)},
+    {Op::Lw, Format::I, FUNCT3_MASK, enc(0x03, 2)},
+    {Op::Ld, Format::I, FUNCT3_MASK, enc(0x03, 3)},
+    {Op::Lbu, Format::I, FUNCT3_MASK, enc(0x03, 4)},
+    {Op::Lhu, Format::I, FUNCT3_MASK, enc(0x03, 5)},
+    {Op::Lwu, Format::I, FUNCT3_MASK, enc(0x03, 6)},
+    {Op::Sb, Format::S, FUNCT3_MASK, enc(0x23, 0)},
+    {Op::Sh, Format::S, FUNCT3_MASK, enc(0x23, 1)},
+    {Op::Sw, Format::S, FUNCT3_MASK, enc(0x23, 2)},
+    {Op::Sd, Format::S, FUNCT3_MASK, enc(0x23, 3)},
+
+    {Op::Addi, Format::I, FUNCT3_MASK, enc(0x13, 0)},
+    {Op::Slti, Format::I, FUNCT3_MASK, enc(0x13, 2)},
+    {Op::Sltiu, Format::I, FUNCT3_MASK, enc(0x13, 3)},
+    {Op::Xori, Format::I, FUNCT3_MASK, enc(0x13, 4)},
+    {Op::Ori, Format::I, FUNCT3_MASK, enc(0x13, 6)},
+    {Op::Andi, Format::I, FUNCT3_MASK, enc(0x13, 7)},
+    {Op::Slli, Format::Shamt6, FUNCT6_MASK, enc(0x13, 1, 0x00)},
+    {Op::Srli, Format::Shamt6, FUNCT6_MASK, enc(0x13, 5, 0x00)},
+    {Op::Srai, Format::Shamt6, FUNCT6_MASK, enc(0x13, 5, 0x20)},
+
+    {Op::Add, Format::R, FUNCT7_MASK, enc(0x33, 0, 0x00)},
+    {Op::Sub, Format::R, FUNCT7_MASK, enc(0x33, 0, 0x20)},
+    {Op::Sll, Format::R, FUNCT7_MASK, enc(0x33, 1, 0x00)},
+    {Op::Slt, Format::R, FUNCT7_MASK, enc(0x33, 2, 0x00)},
+    {Op::Sltu, Format::R, FUNCT7_MASK, enc(0x33, 3, 0x00)},
+    {Op::Xor, Format::R, FUNCT7_MASK, enc(0x33, 4, 0x00)},
+    {Op::Srl, Format::R, FUNCT7_MASK, enc(0x33, 5, 0x00)},
+    {Op::Sra, Format::R, FUNCT7_MASK, enc(0x33, 5, 0x20)},
+    {Op::Or, Format::R, FUNCT7_MASK, enc(0x33, 6, 0x00)},
+    {Op::And, Format::R, FUNCT7_MASK, enc(0x33, 7, 0x00)},
+
+    {Op::Addiw, Format::I, FUNCT3_MASK, enc(0x1b, 0)},
+    {Op::Slliw, Format::Shamt5, FUNCT7_MASK, enc(0x1b, 1, 0x00)},
+    {Op::Srliw, Format::Shamt5, FUNCT7_MASK, enc(0x1b, 5, 0x00)},
+    {Op::Sraiw, Format::Shamt5, FUNCT7_MASK, enc(0x1b, 5, 0x20)},
+    {Op::Addw, Format::R, FUNCT7_MASK, enc(0x3b, 0, 0x00)},
+    {Op::Subw, Format::R, FUNCT7_MASK, enc(0x3b, 0, 0x20)},
+    {Op::Sllw, Format::R, FUNCT7_MASK, enc(0x3b, 1, 0x00)},
+    {Op::Srlw, Format::R, FUNCT7_MASK, enc(0x3b, 5, 0x00)},
+    {Op::Sraw, Format::R, FUNCT7_MASK, enc(0x3b, 5, 0x20)},
+};
+
+// 除 Undecoded、Illegal 和融合指令外，每个操作类型都必须出现在列表中
+static_assert(std::size(INSTS) ==
+              static_cast<size_t>(Op::LuiAddi) - static_cast<size_t>(Op::Lui));
+
+// 两级查找表：第一级以 opcode 和 funct3 为下标（共 1024 项），
+// 需要 funct7 区分的组合再以 funct7 为下标查第二级
+constexpr uint32_t LEVEL1_BITS = FUNCT3_MASK;
+constexpr uint32_t LEVEL2_BITS = 0xfe000000;
+constexpr size_t LEVEL1_SIZE = 1 << 10;
+constexpr size_t LEVEL2_WAYS = 1 << 7;
+
+constexpr bool fits_tables() {
+    for (const auto &d : INSTS) {
+        if ((d.mask & ~(LEVEL1_BITS | LEVEL2_BITS)) != 0 ||
+            (d.mask & OPCODE_MASK) != OPCODE_MASK) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(fits_tables(), "fixed bits outside opcode/funct3/funct7");
+
+constexpr size_t level1_index(uint32_t inst) {
+    return (inst & 0x7f) | ((inst >> 5) & 0x380);
+}
+
+// 第一级下标对应的指令位
+constexpr uint32_t level1_bits(size_t index) {
+    return (index & 0x7f) | (index >> 7) << 12;
+}
+
+struct Entry {
+    Op op = Op::Illegal;
+    Format format = Format::R;
+};
+
+// 第二级的起始位置；不需要 funct7 的组合 funct7_mask 为0，只占一项
+struct Level1 {
+    uint16_t base = 0;
+    uint8_t funct7_mask = 0;
+};
+
+// 完整地匹配一条指令（只看 opcode、funct3 和 funct7），编码重叠时编译失败
+constexpr Entry lookup(uint32_t bits) {
+    Entry entry;
+    int found = 0;
+    for (const auto &d : INSTS) {
+        if ((bits & d.mask) == d.match) {
+            entry = {d.op, d.format};
+            found++;
+        }
+    }
+    if (found > 1) {
+        throw "overlapping instruction encodings";
+    }
+    return entry;
+}
+
+enum class Kind { Illegal, Direct, Split };
+
+constexpr Kind level1_kind(size_t index) {
+    Kind kind = Kind::Illegal;
+    for (const auto &d : INSTS) {
+        if ((level1_bits(index) & d.mask & LEVEL1_BITS) ==
+            (d.match & LEVEL1_BITS)) {
+            if (d.mask & LEVEL2_BITS) {
+                return Kind::Split;
+            }
+            kind = Kind::Direct;
+        }
+    }
+    return kind;
+}
+
+// 第二级的总项数，第0项是所有非法组合共用的 Illegal
+constexpr size_t level2_size() {
+    size_t size = 1;
+    for (size_t i = 0; i < LEVEL1_SIZE; i++) {
+        Kind kind = level1_kind(i);
+        size += kind == Kind::Split ? LEVEL2_WAYS : kind == Kind::Direct;
+    }
+    return size;
+}
+
+struct Tables {
+    std::array<Level1, LEVEL1_SIZE> level1{};
+    std::array<Entry, level2_size()> level2{};
+};
+
+constexpr Tables build_tables() {
+    Tables t;
+    size_t next = 1;
+    for (size_t i = 0; i < LEVEL1_SIZE; i++) {
+        uint32_t bits = level1_bits(i);
+        switch (level1_kind(i)) {
+        case Kind::Illegal:
+            break;
+        case Kind::Direct:
+            t.level1[i] = {static_cast<uint16_t>(next), 0};
+            t.level2[next++] = lookup(bits);
+            break;
+        case Kind::Split:
+            t.level1[i] = {static_cast<uint16_t>(next), 0x7f};
+            for (uint32_t funct7 = 0; funct7 < LEVEL2_WAYS; funct7++) {
+                t.level2[next++] = lookup(bits | funct7 << 25);
+            }
+            break;
+        }
+    }
+    return t;
+}
+
+constexpr Tables TABLES = build_tables();
+
+} // namespace
+
+DecodedInst decode(uint32_t inst) {
+    // 两次查表得到操作类型和格式，中间没有条件分支
+    const Level1 l1 = TABLES.level1[level1_index(inst)];
+    const Entry entry =
+        TABLES.level2[l1.base + ((inst >> 25) & l1.funct7_mask)];
+
+    DecodedInst d{};
+    d.op = entry.op;
+    d.rd = (inst >> 7) & 0x1f;
+    d.rs1 = (inst >> 15) & 0x1f;
+    d.rs2 = (inst >> 20) & 0x1f;
+    d.raw = inst;
+
+    // 各种格式的立即数都算出来再按格式选取，避免随指令类型变化的分支预测失败
+    const int64_t imms[] = {
+        0,           imm_i(inst), imm_s(inst),          imm_b(inst),
+        imm_u(inst), imm_j(inst), (inst >> 20) & 0x3f, (inst >> 20) & 0x1f,
+    };
+    d.imm = imms[static_cast<size_t>(entry.format)];
+    return d;
+}
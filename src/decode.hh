@@ -0,0 +1,76 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <cstdint>
+
+// 预解码后的操作类型列表，各解释器核心的分派表由它生成，顺序即枚举值。
+// Undecoded 必须排在第一位（值为0），这样零初始化的缓存项天然表示“尚未解码”
+#define OP_LIST(X)                                                             \
+    X(Undecoded)                                                               \
+    X(Illegal)                                                                 \
+    /* U/J 型 */                                                               \
+    X(Lui) X(Auipc) X(Jal) X(Jalr)                                             \
+    /* 分支 */                                                                 \
+    X(Beq) X(Bne) X(Blt) X(Bge) X(Bltu) X(Bgeu)                                \
+    /* 访存 */                                                                 \
+    X(Lb) X(Lh) X(Lw) X(Ld) X(Lbu) X(Lhu) X(Lwu)                               \
+    X(Sb) X(Sh) X(Sw) X(Sd)                                                    \
+    /* 立即数运算 */                                                           \
+    X(Addi) X(Slti) X(Sltiu) X(Xori) X(Ori) X(Andi) X(Slli) X(Srli) X(Srai)    \
+    /* 寄存器运算 */                                                           \
+    X(Add) X(Sub) X(Sll) X(Slt) X(Sltu) X(Xor) X(Srl) X(Sra) X(Or) X(And)      \
+    /* RV64 的 32 位字运算 */                                                  \
+    X(Addiw) X(Slliw) X(Srliw) X(Sraiw)                                        \
+    X(Addw) X(Subw) X(Sllw) X(Srlw) X(Sraw)                                    \
+    /* 融合指令（超级指令），只在翻译基本块时由相邻的两条指令合成，见 fusion.hh */ \
+    X(LuiAddi) X(AuipcJalr) X(AuipcLd) X(SlliSrli) X(SltBranch) X(SltuBranch)
+
+#define OP_ENUM(name) name,
+enum class Op : uint8_t { OP_LIST(OP_ENUM) Count };
+#undef OP_ENUM
+
+// 紧凑的解码结果：操作类型、寄存器下标和已经符号扩展好的立即数
+struct DecodedInst {
+    Op op;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    union {
+        uint32_t raw; // 原始指令，便于调试输出
+        int32_t imm2; // 融合指令的第二个立即数
+    };
+    int64_t imm;
+};
+
+static_assert(sizeof(DecodedInst) == 16);
+
+// 各种格式立即数的提取与符号扩展，按照RV手册的位布局拼接
+constexpr int64_t imm_i(uint32_t inst) {
+    return static_cast<int32_t>(inst) >> 20;
+}
+
+constexpr int64_t imm_s(uint32_t inst) {
+    return static_cast<int64_t>(static_cast<int32_t>(inst & 0xfe000000) >> 20) |
+           ((inst >> 7) & 0x1f);
+}
+
+constexpr int64_t imm_b(uint32_t inst) {
+    return static_cast<int64_t>(static_cast<int32_t>(inst & 0x80000000) >> 19) |
+           ((inst & 0x80) << 4) | ((inst >> 20) & 0x7e0) |
+           ((inst >> 7) & 0x1e);
+}
+
+constexpr int64_t imm_u(uint32_t inst) {
+    return static_cast<int32_t>(inst & 0xfffff000);
+}
+
+constexpr int64_t imm_j(uint32_t inst) {
+    return static_cast<int64_t>(static_cast<int32_t>(inst & 0x80000000) >> 11) |
+           (inst & 0xff000) | ((inst >> 9) & 0x800) |
+           ((inst >> 20) & 0x7fe);
+}
+
+// 解码一条32位指令，非法指令得到 Op::Illegal
+DecodedInst decode(uint32_t inst);
+
+#endif
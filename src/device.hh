@@ -0,0 +1,18 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <cstdint>
+#include <optional>
+
+// 挂在总线上的设备（MMIO）。offset 是相对设备窗口起始处的偏移，
+// size 是访问的位数（8，16，32，64），访问不会越出窗口。
+// 设备不支持的访问返回 std::nullopt / false，由总线报告访存异常
+class Device {
+public:
+    virtual ~Device() = default;
+
+    virtual std::optional<uint64_t> load(uint64_t offset, uint64_t size) = 0;
+    virtual bool store(uint64_t offset, uint64_t size, uint64_t value) = 0;
+};
+
+#endif
@@ -1,66 +1,361 @@
-#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
 #include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "dram.hh"
-#include "exception.hh"
 #include "param.hh"
 
-Dram::Dram(const std::vector<uint8_t> &code) {
+namespace {
 
-    // 使用0初始化DRAM。
-    dram.resize(DRAM_SIZE, 0);
+constexpr size_t PAGE_SIZE = size_t{1} << Dram::PAGE_SHIFT;
 
-    // std::copy是标准库算法，用于复制一个范围内的元素到另一个范围。
-    // code.begin()和code.end()分别指向传入vector的开始和结束，指定了要复制的数据范围。
-    // dram.begin()指定了目标范围的开始位置。
-    std::copy(code.begin(), code.end(), dram.begin());
+uint8_t *map_anonymous(size_t length, int flags) {
+    void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return p == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p);
 }
 
-// 输入参数为 addr 表示内存地址，size 表示需要读取的长度
-std::optional<uint64_t> Dram::load(uint64_t addr, uint64_t size) {
+// hugetlbfs 的映射长度按大页取整
+size_t mapped_size(uint64_t size, HugePages huge) {
+    if (huge == HugePages::HugeTlb) {
+        return (size + Dram::HUGE_PAGE_SIZE - 1) & ~(Dram::HUGE_PAGE_SIZE - 1);
+    }
+    return size;
+}
 
-    try {
-        if (size != 8 && size != 16 && size != 32 && size != 64) {
-            throw Exception(Exception::Type::LoadAccessFault, addr);
+// 按 huge 分配 size 字节的 DRAM，huge 改为实际得到的页大小。
+// 地址空间不够时抛出 std::system_error
+uint8_t *map_dram(uint64_t size, HugePages &huge) {
+    if (huge == HugePages::HugeTlb) {
+        // 不带 MAP_NORESERVE：预留不足时 mmap 直接失败，而不是在缺页时收到 SIGBUS
+        if (uint8_t *p = map_anonymous(mapped_size(size, huge), MAP_HUGETLB)) {
+            return p;
         }
-
-        uint64_t nbytes = size / 8;
-        std::size_t index = (addr - DRAM_BASE);
-        if (index + nbytes > dram.size()) {
-            throw std::out_of_range("Address out of range");
+        huge = HugePages::Transparent;
+    }
+    if (huge == HugePages::Off) {
+        uint8_t *p = map_anonymous(size, MAP_NORESERVE);
+        if (p == nullptr) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "cannot map guest RAM");
         }
+        return p;
+    }
 
-        uint64_t value = 0;
+    // 多映射一个大页，截掉首尾使起始地址按 2MiB 对齐，整段内存都能由大页承载
+    const size_t align = Dram::HUGE_PAGE_SIZE;
+    uint8_t *p = map_anonymous(size + align, MAP_NORESERVE);
+    if (p == nullptr) {
+        throw std::system_error(errno, std::generic_category(),
+                                "cannot map guest RAM");
+    }
+    const uintptr_t raw = reinterpret_cast<uintptr_t>(p);
+    const size_t head = ((raw + align - 1) & ~(align - 1)) - raw;
+    if (head != 0) {
+        munmap(p, head);
+    }
+    if (head != align) {
+        munmap(p + head + size, align - head);
+    }
+    // 内核关闭了透明大页时 madvise 失败，仍然可以用普通页运行
+    madvise(p + head, size, MADV_HUGEPAGE);
+    return p + head;
+}
 
-        // 小段序，index + i，i越小，对应的有效位越低
-        for (uint64_t i = 0; i < nbytes; i++) {
-            value |= static_cast<uint64_t>(dram[index + i]) << (i * 8);
+// 从镜像文件 offset 处读出 length 字节到 dst。读取出错时抛出 std::system_error，
+// 文件在打开之后被截短、读不满时抛出 std::runtime_error
+void read_exact(const GuestImage &image, uint8_t *dst, uint64_t length,
+                uint64_t offset) {
+    while (length > 0) {
+        const ssize_t n =
+            pread(image.fd(), dst, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "cannot read " + image.path());
+        }
+        if (n == 0) {
+            throw std::runtime_error("truncated image: " + image.path());
+        }
+        dst += n;
+        length -= static_cast<uint64_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+}
+
+// 把共享镜像的各段放进客户机地址 base 开始、大小为 size 的 dram：
+// 整页部分以 MAP_PRIVATE 覆盖映射，首尾不满一页的部分读入，
+// 这样页里不属于这一段的字节保持为0。.bss 等超出文件内容的部分本来就是0，不用处理。
+// hugetlbfs 的映射不能按 4KiB 拆分，只能把各段的内容全部读入
+void map_image(uint8_t *dram, uint64_t base, uint64_t size,
+               const GuestImage &image, HugePages huge) {
+    for (GuestImage::Segment seg : image.segments()) {
+        if (image.absolute()) {
+            if (seg.addr - base > size || seg.mem_size > size - (seg.addr - base)) {
+                throw std::out_of_range("image segment outside RAM");
+            }
+            seg.addr -= base;
+        } else {
+            seg.file_size = std::min(seg.file_size, size);
+        }
+        const uint64_t begin = seg.addr;
+        const uint64_t end = begin + seg.file_size;
+        // 文件偏移与地址对页的余数不同时不能映射，也只能读入
+        if (huge == HugePages::HugeTlb ||
+            (seg.offset - begin) % PAGE_SIZE != 0) {
+            read_exact(image, dram + begin, seg.file_size, seg.offset);
+            continue;
         }
-        return value;
+        const uint64_t lo = std::min((begin + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1), end);
+        const uint64_t hi = std::max(end & ~(PAGE_SIZE - 1), lo);
+        if (hi > lo) {
+            void *p = mmap(dram + lo, hi - lo, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_FIXED, image.fd(),
+                           static_cast<off_t>(seg.offset + (lo - begin)));
+            if (p == MAP_FAILED) {
+                throw std::system_error(errno, std::generic_category(),
+                                        "cannot map " + image.path());
+            }
+        }
+        read_exact(image, dram + begin, lo - begin, seg.offset);
+        read_exact(image, dram + hi, end - hi, seg.offset + (hi - begin));
+    }
+}
+
+// 平面镜像：放在 RAM 开头的整个文件
+std::vector<GuestImage::Segment> flat_segment(size_t bytes) {
+    return {{0, 0, bytes, bytes}};
+}
 
-    } catch (const Exception &e) {
-        std::cerr << "Exception Dram::load: " << e << std::endl;
-        return std::nullopt;
+} // namespace
+
+GuestImage::GuestImage(const std::vector<uint8_t> &code)
+    : file(memfd_create("crvemu-image", MFD_CLOEXEC)), name("<memory>"),
+      bytes(code.size()),
+      parts(flat_segment(bytes)), fixed(false) {
+    if (file < 0) {
+        throw std::bad_alloc();
+    }
+    if (ftruncate(file, static_cast<off_t>(bytes)) != 0 ||
+        pwrite(file, code.data(), bytes, 0) != static_cast<ssize_t>(bytes)) {
+        close(file);
+        throw std::bad_alloc();
     }
 }
 
-void Dram::store(uint64_t addr, uint64_t size, uint64_t value) {
+std::shared_ptr<const GuestImage> GuestImage::open(const std::string &path) {
+    const int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(file);
+        return nullptr;
+    }
+    const size_t bytes = static_cast<size_t>(st.st_size);
+    return std::shared_ptr<const GuestImage>(
+        new GuestImage(file, path, bytes, flat_segment(bytes), false));
+}
 
+std::shared_ptr<const GuestImage>
+GuestImage::from_segments(int file, const std::string &path, size_t bytes,
+                          std::vector<Segment> segments) {
+    return std::shared_ptr<const GuestImage>(
+        new GuestImage(file, path, bytes, std::move(segments), true));
+}
+
+GuestImage::~GuestImage() {
+    close(file);
+}
+
+Dram::Dram(const MachineConfig &machine, const std::vector<uint8_t> &code,
+           HugePages huge)
+    : ram_base(machine.ram_base), ram_size(machine.ram_size), backing(huge),
+      dram(map_dram(ram_size, backing)), flags(pages(), 0) {
+    // 匿名映射的内容已经是0，只需复制程序镜像
+    const size_t length = std::min<size_t>(code.size(), ram_size);
+    std::copy(code.begin(), code.begin() + length, dram);
+    for (size_t offset = 0; offset < length; offset += PAGE_SIZE) {
+        flags[offset >> PAGE_SHIFT] = PAGE_TOUCHED;
+    }
+}
+
+Dram::Dram(const MachineConfig &machine,
+           std::shared_ptr<const GuestImage> image, HugePages huge)
+    : ram_base(machine.ram_base), ram_size(machine.ram_size), backing(huge),
+      dram(map_dram(ram_size, backing)), image(std::move(image)),
+      flags(pages(), 0) {
     try {
-        if (size != 8 && size != 16 && size != 32 && size != 64) {
-            throw Exception(Exception::Type::StoreAMOAccessFault, addr);
-        }
-        uint64_t nbytes = size / 8;
-        std::size_t index = (addr - DRAM_BASE);
-        if (index + nbytes > dram.size()) {
-            throw std::out_of_range("Address out of range");
+        map_image(dram, ram_base, ram_size, *this->image, backing);
+    } catch (...) {
+        munmap(dram, mapped_size(ram_size, backing));
+        throw;
+    }
+}
+
+Dram::~Dram() {
+    if (dram != nullptr) {
+        munmap(dram, mapped_size(ram_size, backing));
+    }
+}
+
+Dram::Dram(const Dram &other)
+    : ram_base(other.ram_base), ram_size(other.ram_size),
+      backing(other.backing), dram(map_dram(ram_size, backing)),
+      image(other.image), flags(other.flags) {
+    if (image) {
+        map_image(dram, ram_base, ram_size, *image, backing);
+    }
+    for (size_t page = 0; page < pages(); page++) {
+        if (flags[page] & PAGE_TOUCHED) {
+            std::memcpy(dram + (page << PAGE_SHIFT),
+                        other.dram + (page << PAGE_SHIFT), PAGE_SIZE);
         }
+    }
+}
 
-        for (uint64_t i = 0; i < nbytes; i++) {
-            dram[index + i] = (value >> (i * 8)) & 0xFF;
+Dram &Dram::operator=(const Dram &other) {
+    if (this != &other) {
+        Dram copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+Dram::Dram(Dram &&other) noexcept
+    : ram_base(other.ram_base), ram_size(other.ram_size),
+      backing(other.backing), dram(std::exchange(other.dram, nullptr)),
+      image(std::move(other.image)),
+      flags(std::move(other.flags)) {}
+
+Dram &Dram::operator=(Dram &&other) noexcept {
+    std::swap(ram_base, other.ram_base);
+    std::swap(ram_size, other.ram_size);
+    std::swap(backing, other.backing);
+    std::swap(dram, other.dram);
+    std::swap(image, other.image);
+    std::swap(flags, other.flags);
+    return *this;
+}
+
+size_t Dram::touched_pages() const {
+    return std::count_if(flags.begin(), flags.end(),
+                         [](uint8_t f) { return (f & PAGE_TOUCHED) != 0; });
+}
+
+std::vector<uint64_t> Dram::dirty_pages() const {
+    // 一次检查 8 页，大多数页干净时很快跳过
+    constexpr uint64_t DIRTY8 = 0x0101'0101'0101'0101 * PAGE_DIRTY;
+    std::vector<uint64_t> pages;
+    size_t page = 0;
+    for (; page + 8 <= flags.size(); page += 8) {
+        uint64_t word;
+        std::memcpy(&word, flags.data() + page, 8);
+        if ((word & DIRTY8) == 0) {
+            continue;
+        }
+        for (size_t i = page; i < page + 8; i++) {
+            if (flags[i] & PAGE_DIRTY) {
+                pages.push_back(ram_base + (i << PAGE_SHIFT));
+            }
+        }
+    }
+    for (; page < flags.size(); page++) {
+        if (flags[page] & PAGE_DIRTY) {
+            pages.push_back(ram_base + (page << PAGE_SHIFT));
         }
+    }
+    return pages;
+}
+
+void Dram::clear_dirty() {
+    for (uint8_t &f : flags) {
+        f &= ~PAGE_DIRTY;
+    }
+}
 
-    } catch (const Exception &e) {
-        std::cerr << "Exception Dram::store: " << e << std::endl;
+void Dram::clear_code(uint64_t addr, uint64_t len) {
+    const uint64_t offset = addr - ram_base;
+    if (len == 0 || offset >= ram_size) {
+        return;
+    }
+    const uint64_t last = std::min(offset + len - 1, ram_size - 1);
+    for (uint64_t page = offset >> PAGE_SHIFT; page <= last >> PAGE_SHIFT;
+         page++) {
+        flags[page] &= ~PAGE_CODE;
+    }
+}
+
+// 输入参数为 addr 表示内存地址，size 表示需要读取的长度
+std::expected<uint64_t, Exception> Dram::load(uint64_t addr, uint64_t size) {
+    switch (size) {
+    case 8:
+        return load<uint8_t>(addr);
+    case 16:
+        return load<uint16_t>(addr);
+    case 32:
+        return load<uint32_t>(addr);
+    case 64:
+        return load<uint64_t>(addr);
+    default:
+        return std::unexpected(
+            Exception(Exception::Type::LoadAccessFault, addr));
     }
-}
\ No newline at end of file
+}
+
+std::expected<void, Exception> Dram::store(uint64_t addr, uint64_t size,
+                                           uint64_t value) {
+    switch (size) {
+    case 8:
+        return store<uint8_t>(addr, value);
+    case 16:
+        return store<uint16_t>(addr, value);
+    case 32:
+        return store<uint32_t>(addr, value);
+    case 64:
+        return store<uint64_t>(addr, value);
+    default:
+        return std::unexpected(
+            Exception(Exception::Type::StoreAMOAccessFault, addr));
+    }
+}
+
+uint64_t Dram::huge_page_bytes() const {
+    if (backing == HugePages::HugeTlb) {
+        return ram_size;
+    }
+    // smaps 中每段映射以 "起始-结束 ..." 开头，后面是它的各项统计。
+    // 映射镜像后 DRAM 被拆成几段，累加落在 DRAM 范围内的各段
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(dram);
+    const uintptr_t end = begin + ram_size;
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool inside = false;
+    uint64_t bytes = 0;
+    while (std::getline(smaps, line)) {
+        unsigned long lo = 0, hi = 0, kb = 0;
+        if (std::sscanf(line.c_str(), "%lx-%lx ", &lo, &hi) == 2) {
+            inside = lo >= begin && hi <= end;
+        } else if (inside &&
+                   std::sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb) ==
+                       1) {
+            bytes += uint64_t{kb} << 10;
+        }
+    }
+    return bytes;
+}
@@ -1,23 +1,263 @@
 #ifndef DRAM_H
 #define DRAM_H
 
+#include <bit>
+#include <concepts>
 #include <cstdint>
-#include <optional>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <string>
 #include <vector>
 
-// 内存（DRAM）只有两个功能：store，load。保存和读取的有效位数是 8，16，32，64
+#include "exception.hh"
+#include "param.hh"
+
+// 访存的数据类型：8/16/32/64 位无符号整数
+template <typename T>
+concept MemWord = std::same_as<T, uint8_t> || std::same_as<T, uint16_t> ||
+                  std::same_as<T, uint32_t> || std::same_as<T, uint64_t>;
+
+// 从宿主机内存 p 处按客户机的小端字节序读写一个 T
+template <MemWord T> inline T host_load(const uint8_t *p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+template <MemWord T> inline void host_store(uint8_t *p, T value) {
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    std::memcpy(p, &value, sizeof(T));
+}
+
+// 可以实例化多次的客户机程序镜像：内容放在 memfd 或镜像文件中，各个 Dram 以 MAP_PRIVATE 映射，
+// 没有写过的页由所有实例共用同一份物理内存，写入时由内核复制出私有的页
+class GuestImage {
+public:
+    // 文件中的一段内容放到客户机地址 addr 开始的 mem_size 字节，超出 file_size 的部分是0
+    struct Segment {
+        uint64_t addr;
+        uint64_t offset; // 在文件中的偏移
+        uint64_t file_size;
+        uint64_t mem_size;
+    };
+
+    explicit GuestImage(const std::vector<uint8_t> &code);
+    ~GuestImage();
+
+    // 直接映射镜像文件，不读入也不复制：客户机第一次访问某页时才从页缓存中取出。
+    // 打开失败时返回空指针。映射期间文件被修改的话，没有写过的页会看到新的内容
+    static std::shared_ptr<const GuestImage> open(const std::string &path);
+
+    // 按 segments 映射已经打开的文件 file，接管 file 的所有权。用于 ELF 等分段的镜像，
+    // 各段的地址是客户机物理地址，必须落在 RAM 内且互不重叠。path 只用于报告错误
+    static std::shared_ptr<const GuestImage>
+    from_segments(int file, const std::string &path, size_t bytes,
+                  std::vector<Segment> segments);
+
+    GuestImage(const GuestImage &) = delete;
+    GuestImage &operator=(const GuestImage &) = delete;
+
+    int fd() const {
+        return file;
+    }
+
+    // 镜像文件的路径，内存中的镜像是 "<memory>"
+    const std::string &path() const {
+        return name;
+    }
+
+    // 文件的字节数
+    size_t size() const {
+        return bytes;
+    }
+
+    // 平面镜像只有一段：整个文件放在 RAM 开头，地址是相对 RAM 起始地址的偏移0，
+    // 超出 RAM 的部分截掉。其他镜像的地址是客户机物理地址，见 absolute()
+    const std::vector<Segment> &segments() const {
+        return parts;
+    }
+    bool absolute() const {
+        return fixed;
+    }
+
+private:
+    GuestImage(int file, std::string path, size_t bytes,
+               std::vector<Segment> segments, bool absolute)
+        : file(file), name(std::move(path)), bytes(bytes),
+          parts(std::move(segments)), fixed(absolute) {}
+
+    int file = -1;
+    std::string name;
+    size_t bytes = 0;
+    std::vector<Segment> parts;
+    bool fixed = false;
+};
+
+// 客户机 RAM 的宿主机页大小。随机访问的客户机程序在 4KiB 页上 TLB 缺失很多，
+// 用 2MiB 的大页可以减少缺失
+enum class HugePages : uint8_t {
+    Off,         // 普通的 4KiB 页
+    Transparent, // 按 2MiB 对齐并 madvise(MADV_HUGEPAGE)，由内核的透明大页按需分配
+    HugeTlb,     // 从 hugetlbfs 预留的大页中分配，预留不足时退回 Transparent
+};
+
+// 内存（DRAM）只有两个功能：store，load。保存和读取的有效位数是 8，16，32，64。
+// 出错时以返回值带回异常，不抛出。位置和大小由 MachineConfig 的 ram_base/ram_size 决定。
+// 内存用匿名 mmap（MAP_NORESERVE）按需分配：没有访问过的页不占物理内存，读出来是0。
+// 另外每页一个字节记录标志（见 page_flags）：写过的页（拷贝时只需复制这些页）、
+// 上次清除以来写过的脏页，以及含有预解码或翻译过的代码的页
 class Dram {
 public:
-    Dram();
+    static constexpr uint64_t PAGE_SHIFT = 12;
+
+    // 页标志。TOUCHED 表示创建以来写过，从不清除；DIRTY 表示上次 clear_dirty 以来写过；
+    // CODE 由 CPU 在页中的指令被预解码或翻译时设置，写入这样的页之前要让它们失效
+    static constexpr uint8_t PAGE_TOUCHED = 1;
+    static constexpr uint8_t PAGE_DIRTY = 2;
+    static constexpr uint8_t PAGE_CODE = 4;
+    static constexpr uint8_t PAGE_WRITTEN = PAGE_TOUCHED | PAGE_DIRTY;
+
+    static constexpr uint64_t HUGE_PAGE_SIZE = uint64_t{1} << 21;
+
+    // 把程序镜像复制到 DRAM 开头，这些页算作写过。machine 必须通过 MachineConfig::check
+    Dram(const MachineConfig &machine, const std::vector<uint8_t> &code,
+         HugePages huge = HugePages::Off);
+
+    // 把共享镜像的各段以写时复制的方式映射到 DRAM 中，只复制各段首尾不满一页的部分。
+    // 使用 hugetlbfs 时大页不能与镜像的 4KiB 页混合映射，改为复制镜像。
+    // 有段落在 DRAM 之外时抛出 std::out_of_range
+    Dram(const MachineConfig &machine, std::shared_ptr<const GuestImage> image,
+         HugePages huge = HugePages::Off);
+
+    // 使用默认机器的布局
+    Dram(const std::vector<uint8_t> &code, HugePages huge = HugePages::Off)
+        : Dram(MachineConfig{}, code, huge) {}
+    Dram(std::shared_ptr<const GuestImage> image,
+         HugePages huge = HugePages::Off)
+        : Dram(MachineConfig{}, std::move(image), huge) {}
+
+    ~Dram();
+
+    // 拷贝时使用与 other 相同的页大小，重新映射共享镜像，只复制写过的页，开销与写过的页数成正比
+    Dram(const Dram &other);
+    Dram &operator=(const Dram &other);
+    Dram(Dram &&other) noexcept;
+    Dram &operator=(Dram &&other) noexcept;
+
+    // 按类型访存：一次越界检查加一次 memcpy，在小端宿主机上就是一条读写指令
+    template <MemWord T> std::expected<T, Exception> load(uint64_t addr) const {
+        const uint64_t index = addr - ram_base;
+        if (index > ram_size - sizeof(T)) {
+            return std::unexpected(
+                Exception(Exception::Type::LoadAccessFault, addr));
+        }
+        return host_load<T>(dram + index);
+    }
+
+    template <MemWord T>
+    std::expected<void, Exception> store(uint64_t addr, T value) {
+        const uint64_t index = addr - ram_base;
+        if (index > ram_size - sizeof(T)) {
+            return std::unexpected(
+                Exception(Exception::Type::StoreAMOAccessFault, addr));
+        }
+        host_store<T>(dram + index, value);
+        touch(index, sizeof(T));
+        return {};
+    }
+
+    // 按运行时给出的位数访存，转发给上面的模板
+    std::expected<uint64_t, Exception> load(uint64_t addr, uint64_t size);
+
+    std::expected<void, Exception> store(uint64_t addr, uint64_t size,
+                                         uint64_t value);
+
+    // 宿主机上的内存起始地址，供即时编译的代码直接访问
+    uint8_t *data() {
+        return dram;
+    }
+
+    // 客户机地址 [base(), base() + size()) 对应从 data() 开始的宿主机内存
+    uint64_t base() const {
+        return ram_base;
+    }
+    uint64_t size() const {
+        return ram_size;
+    }
+
+    // 页数，也是 page_flags() 的长度
+    uint64_t pages() const {
+        return ram_size >> PAGE_SHIFT;
+    }
+
+    // 绕过 store 直接写入宿主机内存 [offset, offset + len) 之后调用，len 不超过一页。
+    // 把涉及的页标记为写过，返回它们原来标志的并集，调用者据此判断是否写到了代码页
+    uint8_t touch(uint64_t offset, uint64_t len) {
+        uint8_t &first = flags[offset >> PAGE_SHIFT];
+        uint8_t &last = flags[(offset + len - 1) >> PAGE_SHIFT];
+        const uint8_t old = first | last;
+        first |= PAGE_WRITTEN;
+        last |= PAGE_WRITTEN;
+        return old;
+    }
+
+    // 每页一个字节的标志（PAGE_*），供即时编译和离线翻译的代码直接检查和标记
+    uint8_t *page_flags() {
+        return flags.data();
+    }
+
+    // 写过的页数
+    size_t touched_pages() const;
+
+    // 上次 clear_dirty 以来写过的页，按客户机地址从小到大排列。
+    // 加载镜像不算写入，拷贝 Dram 时连同脏页记录一起复制
+    std::vector<uint64_t> dirty_pages() const;
+
+    // addr 所在的页是否是脏页，RAM 之外的地址返回 false
+    bool dirty(uint64_t addr) const {
+        const uint64_t offset = addr - ram_base;
+        return offset < ram_size && (flags[offset >> PAGE_SHIFT] & PAGE_DIRTY);
+    }
+
+    // 清除全部脏页记录，开始新一轮记录；不影响 touched_pages
+    void clear_dirty();
+
+    // 标记 addr（必须在 RAM 中）所在的页含有代码
+    void mark_code(uint64_t addr) {
+        flags[(addr - ram_base) >> PAGE_SHIFT] |= PAGE_CODE;
+    }
+
+    // addr 所在的页是否标记为含有代码
+    bool has_code(uint64_t addr) const {
+        const uint64_t offset = addr - ram_base;
+        return offset < ram_size && (flags[offset >> PAGE_SHIFT] & PAGE_CODE);
+    }
 
-    Dram(const std::vector<uint8_t> &code);
+    // 清除 [addr, addr + len) 涉及的页的代码标记，RAM 之外的部分忽略
+    void clear_code(uint64_t addr, uint64_t len);
 
-    std::optional<uint64_t> load(uint64_t addr, uint64_t size);
+    // 实际得到的页大小：hugetlbfs 预留不足时是 Transparent
+    HugePages huge_pages() const {
+        return backing;
+    }
 
-    void store(uint64_t addr, uint64_t size, uint64_t value);
+    // 当前由大页承载的字节数。透明大页由内核在缺页时按需分配，
+    // 从 /proc/self/smaps 中这段内存的 AnonHugePages 读出
+    uint64_t huge_page_bytes() const;
 
 private:
-    std::vector<uint8_t> dram;
+    uint64_t ram_base;
+    uint64_t ram_size;
+    HugePages backing; // 先于 dram 初始化，映射时改成实际得到的页大小
+    uint8_t *dram = nullptr;
+    std::shared_ptr<const GuestImage> image;
+    std::vector<uint8_t> flags;
 };
 
-#endif
\ No newline at end of file
+#endif
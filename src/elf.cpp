@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cstring>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "elf.hh"
+#include "param.hh"
+
+namespace {
+
+// 只读映射整个文件用于解析头部和符号表，析构时解除映射
+class FileView {
+public:
+    FileView(int file, size_t bytes) : bytes(bytes) {
+        if (bytes > 0) {
+            void *p = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, file, 0);
+            data = p == MAP_FAILED ? nullptr : static_cast<uint8_t *>(p);
+        }
+    }
+    ~FileView() {
+        if (data != nullptr) {
+            munmap(data, bytes);
+        }
+    }
+
+    FileView(const FileView &) = delete;
+    FileView &operator=(const FileView &) = delete;
+
+    // [offset, offset + count * sizeof(T)) 在文件内时返回指向它的指针
+    template <typename T>
+    const T *at(uint64_t offset, uint64_t count = 1) const {
+        if (data == nullptr || offset > bytes ||
+            count > (bytes - offset) / sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T *>(data + offset);
+    }
+
+private:
+    uint8_t *data = nullptr;
+    size_t bytes;
+};
+
+std::unexpected<std::string> error(const std::string &path,
+                                   const std::string &what) {
+    return std::unexpected(path + ": " + what);
+}
+
+// 读出 SHT_SYMTAB 中有名字、有定义的函数和数据对象
+std::vector<ElfSymbol> read_symbols(const FileView &view,
+                                    const Elf64_Ehdr &eh) {
+    std::vector<ElfSymbol> symbols;
+    const auto *sections = view.at<Elf64_Shdr>(eh.e_shoff, eh.e_shnum);
+    if (sections == nullptr || eh.e_shentsize != sizeof(Elf64_Shdr)) {
+        return symbols;
+    }
+    for (size_t i = 0; i < eh.e_shnum; i++) {
+        const Elf64_Shdr &sh = sections[i];
+        if (sh.sh_type != SHT_SYMTAB || sh.sh_link >= eh.e_shnum) {
+            continue;
+        }
+        const Elf64_Shdr &strtab = sections[sh.sh_link];
+        const auto *names = view.at<char>(strtab.sh_offset, strtab.sh_size);
+        const auto *syms =
+            view.at<Elf64_Sym>(sh.sh_offset, sh.sh_size / sizeof(Elf64_Sym));
+        if (names == nullptr || syms == nullptr) {
+            continue;
+        }
+        for (size_t j = 0; j < sh.sh_size / sizeof(Elf64_Sym); j++) {
+            const Elf64_Sym &sym = syms[j];
+            const unsigned type = ELF64_ST_TYPE(sym.st_info);
+            if ((type != STT_FUNC && type != STT_OBJECT) ||
+                sym.st_shndx == SHN_UNDEF || sym.st_name >= strtab.sh_size) {
+                continue;
+            }
+            const char *name = names + sym.st_name;
+            symbols.push_back(
+                {std::string(name, strnlen(name, strtab.sh_size - sym.st_name)),
+                 sym.st_value, sym.st_size, type == STT_FUNC});
+        }
+    }
+    std::sort(symbols.begin(), symbols.end(),
+              [](const ElfSymbol &a, const ElfSymbol &b) {
+                  return a.addr < b.addr;
+              });
+    return symbols;
+}
+
+} // namespace
+
+const ElfSymbol *ElfProgram::symbol_at(uint64_t addr) const {
+    auto it = std::upper_bound(
+        symbols.begin(), symbols.end(), addr,
+        [](uint64_t a, const ElfSymbol &sym) { return a < sym.addr; });
+    if (it == symbols.begin()) {
+        return nullptr;
+    }
+    const ElfSymbol &sym = *std::prev(it);
+    if (sym.size != 0 && addr - sym.addr >= sym.size) {
+        return nullptr;
+    }
+    return &sym;
+}
+
+bool is_elf(const std::string &path) {
+    const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return false;
+    }
+    unsigned char magic[SELFMAG];
+    const bool elf = pread(file, magic, SELFMAG, 0) == SELFMAG &&
+                     std::memcmp(magic, ELFMAG, SELFMAG) == 0;
+    close(file);
+    return elf;
+}
+
+std::expected<ElfProgram, std::string> load_elf(const std::string &path,
+                                                const MachineConfig &machine) {
+    const int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return error(path, "cannot open");
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0) {
+        close(file);
+        return error(path, "cannot stat");
+    }
+    const size_t bytes = static_cast<size_t>(st.st_size);
+    // 出错时关闭文件；成功时文件交给 GuestImage
+    auto fail = [&](const std::string &what) {
+        close(file);
+        return error(path, what);
+    };
+
+    FileView view(file, bytes);
+    const auto *eh = view.at<Elf64_Ehdr>(0);
+    if (eh == nullptr || std::memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) {
+        return fail("not an ELF file");
+    }
+    if (eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_ident[EI_DATA] != ELFDATA2LSB || eh->e_machine != EM_RISCV) {
+        return fail("not a little-endian RISC-V ELF64 file");
+    }
+    if (eh->e_type != ET_EXEC) {
+        return fail("not an executable");
+    }
+    const auto *phdrs = view.at<Elf64_Phdr>(eh->e_phoff, eh->e_phnum);
+    if (phdrs == nullptr || eh->e_phentsize != sizeof(Elf64_Phdr)) {
+        return fail("bad program headers");
+    }
+
+    std::vector<GuestImage::Segment> segments;
+    for (size_t i = 0; i < eh->e_phnum; i++) {
+        const Elf64_Phdr &ph = phdrs[i];
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0) {
+            continue;
+        }
+        if (ph.p_filesz > ph.p_memsz || ph.p_offset > bytes ||
+            ph.p_filesz > bytes - ph.p_offset) {
+            return fail("bad PT_LOAD segment");
+        }
+        if (ph.p_paddr - machine.ram_base > machine.ram_size ||
+            ph.p_memsz > machine.ram_size - (ph.p_paddr - machine.ram_base)) {
+            return fail("PT_LOAD segment outside RAM");
+        }
+        segments.push_back({ph.p_paddr, ph.p_offset, ph.p_filesz, ph.p_memsz});
+    }
+    std::sort(segments.begin(), segments.end(),
+              [](const GuestImage::Segment &a, const GuestImage::Segment &b) {
+                  return a.addr < b.addr;
+              });
+    for (size_t i = 1; i < segments.size(); i++) {
+        if (segments[i - 1].addr + segments[i - 1].mem_size >
+            segments[i].addr) {
+            return fail("overlapping PT_LOAD segments");
+        }
+    }
+
+    ElfProgram program;
+    program.entry = eh->e_entry;
+    program.symbols = read_symbols(view, *eh);
+    program.image = GuestImage::from_segments(file, path, bytes,
+                                              std::move(segments));
+    return program;
+}
@@ -0,0 +1,42 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dram.hh"
+#include "param.hh"
+
+// ELF 符号表中的一个函数或数据对象
+struct ElfSymbol {
+    std::string name;
+    uint64_t addr;
+    uint64_t size;
+    bool function;
+};
+
+// 加载好的 RISC-V ELF64 可执行文件
+struct ElfProgram {
+    // PT_LOAD 段组成的镜像，各段按物理地址（p_paddr）放进 RAM，.bss 不占文件也不预先清零
+    std::shared_ptr<const GuestImage> image;
+    // 入口地址，加载后作为 pc
+    uint64_t entry = 0;
+    // 按地址排序的符号
+    std::vector<ElfSymbol> symbols;
+
+    // 包含 addr 的符号，找不到时返回空指针。大小为0的符号覆盖到下一个符号之前
+    const ElfSymbol *symbol_at(uint64_t addr) const;
+};
+
+// 文件是否以 ELF 魔数开头
+bool is_elf(const std::string &path);
+
+// 解析 path 处的 ELF64 小端 RISC-V 可执行文件，只映射不复制。
+// 文件格式不对、段落在 machine 的 RAM 之外时返回错误信息
+std::expected<ElfProgram, std::string>
+load_elf(const std::string &path, const MachineConfig &machine = {});
+
+#endif
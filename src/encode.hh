@@ -0,0 +1,183 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <cstdint>
+#include <vector>
+
+// 简易指令编码器：不依赖交叉工具链，直接生成机器码，供测试和基准程序使用
+namespace Rv {
+
+constexpr uint32_t r_type(uint32_t opcode, uint32_t rd, uint32_t funct3,
+                          uint32_t rs1, uint32_t rs2, uint32_t funct7) {
+    return opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) | (rs2 << 20) |
+           (funct7 << 25);
+}
+
+constexpr uint32_t i_type(uint32_t opcode, uint32_t rd, uint32_t funct3,
+                          uint32_t rs1, int32_t imm) {
+    return opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) |
+           (static_cast<uint32_t>(imm) << 20);
+}
+
+constexpr uint32_t s_type(uint32_t opcode, uint32_t funct3, uint32_t rs1,
+                          uint32_t rs2, int32_t imm) {
+    auto u = static_cast<uint32_t>(imm);
+    return opcode | ((u & 0x1f) << 7) | (funct3 << 12) | (rs1 << 15) |
+           (rs2 << 20) | (((u >> 5) & 0x7f) << 25);
+}
+
+constexpr uint32_t b_type(uint32_t funct3, uint32_t rs1, uint32_t rs2,
+                          int32_t imm) {
+    auto u = static_cast<uint32_t>(imm);
+    return 0x63 | (((u >> 11) & 0x1) << 7) | (((u >> 1) & 0xf) << 8) |
+           (funct3 << 12) | (rs1 << 15) | (rs2 << 20) |
+           (((u >> 5) & 0x3f) << 25) | (((u >> 12) & 0x1) << 31);
+}
+
+constexpr uint32_t lui(uint32_t rd, int32_t imm20) {
+    return 0x37 | (rd << 7) | (static_cast<uint32_t>(imm20) << 12);
+}
+
+constexpr uint32_t auipc(uint32_t rd, int32_t imm20) {
+    return 0x17 | (rd << 7) | (static_cast<uint32_t>(imm20) << 12);
+}
+
+constexpr uint32_t jal(uint32_t rd, int32_t imm) {
+    auto u = static_cast<uint32_t>(imm);
+    return 0x6f | (rd << 7) | (((u >> 12) & 0xff) << 12) |
+           (((u >> 11) & 0x1) << 20) | (((u >> 1) & 0x3ff) << 21) |
+           (((u >> 20) & 0x1) << 31);
+}
+
+constexpr uint32_t jalr(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x67, rd, 0, rs1, imm);
+}
+
+constexpr uint32_t beq(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return b_type(0, rs1, rs2, imm);
+}
+constexpr uint32_t bne(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return b_type(1, rs1, rs2, imm);
+}
+constexpr uint32_t blt(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return b_type(4, rs1, rs2, imm);
+}
+constexpr uint32_t bge(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return b_type(5, rs1, rs2, imm);
+}
+constexpr uint32_t bltu(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return b_type(6, rs1, rs2, imm);
+}
+constexpr uint32_t bgeu(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return b_type(7, rs1, rs2, imm);
+}
+
+constexpr uint32_t lb(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 0, rs1, imm);
+}
+constexpr uint32_t lh(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 1, rs1, imm);
+}
+constexpr uint32_t lw(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 2, rs1, imm);
+}
+constexpr uint32_t ld(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 3, rs1, imm);
+}
+constexpr uint32_t lbu(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 4, rs1, imm);
+}
+constexpr uint32_t lhu(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 5, rs1, imm);
+}
+constexpr uint32_t lwu(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x03, rd, 6, rs1, imm);
+}
+constexpr uint32_t sb(uint32_t rs2, uint32_t rs1, int32_t imm) {
+    return s_type(0x23, 0, rs1, rs2, imm);
+}
+constexpr uint32_t sw(uint32_t rs2, uint32_t rs1, int32_t imm) {
+    return s_type(0x23, 2, rs1, rs2, imm);
+}
+constexpr uint32_t sd(uint32_t rs2, uint32_t rs1, int32_t imm) {
+    return s_type(0x23, 3, rs1, rs2, imm);
+}
+
+constexpr uint32_t addi(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x13, rd, 0, rs1, imm);
+}
+constexpr uint32_t slti(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x13, rd, 2, rs1, imm);
+}
+constexpr uint32_t xori(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x13, rd, 4, rs1, imm);
+}
+constexpr uint32_t andi(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x13, rd, 7, rs1, imm);
+}
+constexpr uint32_t slli(uint32_t rd, uint32_t rs1, uint32_t shamt) {
+    return i_type(0x13, rd, 1, rs1, static_cast<int32_t>(shamt));
+}
+constexpr uint32_t srli(uint32_t rd, uint32_t rs1, uint32_t shamt) {
+    return i_type(0x13, rd, 5, rs1, static_cast<int32_t>(shamt));
+}
+constexpr uint32_t srai(uint32_t rd, uint32_t rs1, uint32_t shamt) {
+    return i_type(0x13, rd, 5, rs1, static_cast<int32_t>(shamt | 0x400));
+}
+
+constexpr uint32_t add(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 0, rs1, rs2, 0x00);
+}
+constexpr uint32_t sub(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 0, rs1, rs2, 0x20);
+}
+constexpr uint32_t sll(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 1, rs1, rs2, 0x00);
+}
+constexpr uint32_t slt(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 2, rs1, rs2, 0x00);
+}
+constexpr uint32_t sltu(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 3, rs1, rs2, 0x00);
+}
+constexpr uint32_t xor_(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 4, rs1, rs2, 0x00);
+}
+constexpr uint32_t srl(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 5, rs1, rs2, 0x00);
+}
+constexpr uint32_t sra(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 5, rs1, rs2, 0x20);
+}
+constexpr uint32_t or_(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 6, rs1, rs2, 0x00);
+}
+constexpr uint32_t and_(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x33, rd, 7, rs1, rs2, 0x00);
+}
+
+constexpr uint32_t addiw(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return i_type(0x1b, rd, 0, rs1, imm);
+}
+constexpr uint32_t addw(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x3b, rd, 0, rs1, rs2, 0x00);
+}
+constexpr uint32_t subw(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return r_type(0x3b, rd, 0, rs1, rs2, 0x20);
+}
+
+// 把指令序列按小端序展开为内存镜像
+inline std::vector<uint8_t> to_bytes(const std::vector<uint32_t> &insts) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(insts.size() * 4);
+    for (uint32_t inst : insts) {
+        for (int i = 0; i < 4; i++) {
+            bytes.push_back(static_cast<uint8_t>(inst >> (i * 8)));
+        }
+    }
+    return bytes;
+}
+
+} // namespace Rv
+
+#endif
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <numeric>
+
+#include "fusion.hh"
+#include "semantics.hh"
+
+const char *FusionStats::name(size_t kind) {
+    static constexpr const char *names[KINDS] = {
+        "lui+addi", "auipc+jalr", "auipc+ld",
+        "slli+srli", "slt+branch", "sltu+branch"};
+    return names[kind];
+}
+
+uint64_t FusionStats::total_executed() const {
+    return std::accumulate(executed.begin(), executed.end(), uint64_t{0});
+}
+
+void FusionStats::dump() const {
+    std::cout << "Fused instruction pairs (translated / executed):" << std::endl;
+    for (size_t i = 0; i < KINDS; i++) {
+        std::cout << "  " << name(i) << ": " << translated[i] << " / "
+                  << executed[i] << std::endl;
+    }
+}
+
+std::optional<DecodedInst> fuse(const DecodedInst &first,
+                                const DecodedInst &second) {
+    // 第一条指令的结果必须写入非 x0 寄存器，并且被第二条指令使用
+    if (first.rd == 0 || first.rd == ZERO_SINK) {
+        return std::nullopt;
+    }
+    DecodedInst fused{};
+    fused.rd = second.rd;
+    fused.rs1 = first.rs1;
+    fused.rs2 = first.rs2;
+
+    switch (first.op) {
+    case Op::Lui:
+        if ((second.op == Op::Addi || second.op == Op::Addiw) &&
+            second.rs1 == first.rd && second.rd == first.rd) {
+            fused.op = Op::LuiAddi;
+            uint64_t value = first.imm + second.imm;
+            fused.imm = static_cast<int64_t>(
+                second.op == Op::Addiw ? sext32(value) : value);
+            return fused;
+        }
+        break;
+    case Op::Auipc:
+        if ((second.op == Op::Jalr || second.op == Op::Ld) &&
+            second.rs1 == first.rd) {
+            fused.op = second.op == Op::Jalr ? Op::AuipcJalr : Op::AuipcLd;
+            fused.rs1 = first.rd;
+            fused.imm = first.imm;
+            fused.imm2 = static_cast<int32_t>(second.imm);
+            return fused;
+        }
+        break;
+    case Op::Slli:
+        if (second.op == Op::Srli && second.rs1 == first.rd &&
+            second.rd == first.rd) {
+            fused.op = Op::SlliSrli;
+            fused.imm = first.imm;
+            fused.imm2 = static_cast<int32_t>(second.imm);
+            return fused;
+        }
+        break;
+    case Op::Slt:
+    case Op::Sltu:
+        if ((second.op == Op::Bne || second.op == Op::Beq) &&
+            second.rs1 == first.rd && second.rs2 == 0) {
+            fused.op = first.op == Op::Slt ? Op::SltBranch : Op::SltuBranch;
+            fused.rd = first.rd;
+            fused.imm = second.imm + 4;
+            fused.imm2 = second.op == Op::Bne;
+            return fused;
+        }
+        break;
+    default:
+        break;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,43 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include "decode.hh"
+
+// 超级指令：编译器生成的代码中常见的固定指令对，翻译基本块时合成一条融合指令，
+// 只需一次分派，执行结果（包括中间寄存器和 instret）与分别执行两条指令相同
+//   LuiAddi    lui rd, hi; addi[w] rd, rd, lo     加载常量，imm 为最终结果
+//   AuipcJalr  auipc t, hi; jalr rd, lo(t)        远调用，imm = hi，imm2 = lo
+//   AuipcLd    auipc t, hi; ld rd, lo(t)          GOT 读取，imm = hi，imm2 = lo
+//   SlliSrli   slli rd, rs, a; srli rd, rd, b     零扩展/位段提取，imm = a，imm2 = b
+//   SltBranch  slt t, a, b; bnez/beqz t, off      比较后分支，imm 为相对融合指令的偏移，
+//   SltuBranch （同上，无符号比较）                imm2 非0表示 bnez
+struct FusionStats {
+    static constexpr size_t KINDS =
+        static_cast<size_t>(Op::SltuBranch) - static_cast<size_t>(Op::LuiAddi) + 1;
+
+    // 翻译时合成的数量
+    std::array<uint64_t, KINDS> translated{};
+    // 融合指令被执行的次数（即时编译的代码不计入）
+    std::array<uint64_t, KINDS> executed{};
+
+    static size_t kind(Op op) {
+        return static_cast<size_t>(op) - static_cast<size_t>(Op::LuiAddi);
+    }
+
+    static const char *name(size_t kind);
+
+    uint64_t total_executed() const;
+
+    // 打印统计信息
+    void dump() const;
+};
+
+// 尝试把相邻的两条指令融合为一条，不能融合时返回 std::nullopt
+std::optional<DecodedInst> fuse(const DecodedInst &first,
+                                const DecodedInst &second);
+
+#endif
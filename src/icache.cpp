@@ -0,0 +1,24 @@
+#include "icache.hh"
+
+void DecodeCache::invalidate(uint64_t addr, uint64_t len) {
+    if (pages.empty()) {
+        return;
+    }
+    uint64_t first = addr >> PAGE_SHIFT;
+    uint64_t last = (addr + len - 1) >> PAGE_SHIFT;
+    for (uint64_t tag = first; tag <= last; tag++) {
+        auto it = pages.find(tag);
+        if (it == pages.end()) {
+            continue;
+        }
+        if (last_page == it->second.get()) {
+            last_page = nullptr;
+        }
+        pages.erase(it);
+    }
+}
+
+void DecodeCache::clear() {
+    pages.clear();
+    last_page = nullptr;
+}
@@ -0,0 +1,62 @@
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include "decode.hh"
+
+// 预解码指令缓存：以 4KiB 页为单位保存已解码的指令，
+// 第一次取指时填充，向代码页写入时整页失效
+class DecodeCache {
+public:
+    static constexpr uint64_t PAGE_SHIFT = 12;
+    static constexpr uint64_t PAGE_SIZE = 1 << PAGE_SHIFT;
+    static constexpr uint64_t PAGE_INSTS = PAGE_SIZE / 4;
+
+    DecodeCache() = default;
+
+    // 缓存只是内存内容的派生状态，拷贝 Cpu 时从空缓存开始即可
+    DecodeCache(const DecodeCache &) {}
+    DecodeCache &operator=(const DecodeCache &) {
+        clear();
+        return *this;
+    }
+    DecodeCache(DecodeCache &&) = default;
+    DecodeCache &operator=(DecodeCache &&) = default;
+
+    // 返回 pc 对应的缓存项，尚未解码时其 op 为 Op::Undecoded。
+    // pc 必须按4字节对齐，否则会得到同一字内对齐地址的缓存项
+    DecodedInst &slot(uint64_t pc) {
+        uint64_t tag = pc >> PAGE_SHIFT;
+        if (tag != last_tag || !last_page) {
+            auto &page = pages[tag];
+            if (!page) {
+                page = std::make_unique<Page>();
+            }
+            last_tag = tag;
+            last_page = page.get();
+        }
+        return last_page->insts[(pc & (PAGE_SIZE - 1)) >> 2];
+    }
+
+    // 写入 [addr, addr + len) 时调用，丢弃涉及的代码页
+    void invalidate(uint64_t addr, uint64_t len);
+
+    void clear();
+
+private:
+    struct Page {
+        std::array<DecodedInst, PAGE_INSTS> insts{};
+    };
+
+    std::unordered_map<uint64_t, std::unique_ptr<Page>> pages;
+
+    // 最近访问的页，顺序执行和循环基本都落在同一页内
+    uint64_t last_tag = 0;
+    Page *last_page = nullptr;
+};
+
+#endif
@@ -0,0 +1,893 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "dram.hh"
+#include "jit.hh"
+
+#if defined(__x86_64__)
+
+namespace {
+
+// 生成代码中使用的宿主机寄存器：
+//   rdi = JitContext*，rbx = regs，r12 = ram，r13 = page_flags，r14 = ram_limit
+//   rax/rcx/rdx 为临时寄存器，其余的分配给块内最常用的客户机寄存器
+enum HostReg : uint8_t {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBP = 5,
+    RSI = 6,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R15 = 15,
+};
+
+// 可分配给客户机寄存器的宿主机寄存器。生成的代码不调用任何函数，
+// 调用者保存的寄存器可以随意使用，rbp/r15 需要在入口保存
+constexpr HostReg ALLOCATABLE[] = {RSI, R8, R9, R10, R11, R15, RBP};
+constexpr int8_t IN_MEMORY = -1;
+
+// x86 条件码
+enum Cond : uint8_t {
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+};
+
+// 简易的 x86-64 指令编码器，只覆盖翻译 RV64I 所需的少量形式
+class Emitter {
+public:
+    std::vector<uint8_t> buf;
+
+    // 客户机寄存器所在的宿主机寄存器，IN_MEMORY 表示留在 regs 数组中
+    std::array<int8_t, REG_SLOTS> host;
+
+    Emitter() {
+        host.fill(IN_MEMORY);
+    }
+
+    void bytes(std::initializer_list<uint8_t> list) {
+        buf.insert(buf.end(), list);
+    }
+
+    void imm32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            buf.push_back(static_cast<uint8_t>(v >> (i * 8)));
+        }
+    }
+
+    void imm64(uint64_t v) {
+        imm32(static_cast<uint32_t>(v));
+        imm32(static_cast<uint32_t>(v >> 32));
+    }
+
+    size_t pos() const {
+        return buf.size();
+    }
+
+    // REX.W 前缀，reg/rm 为 r8 以上时带上扩展位
+    static uint8_t rex(int reg, int rm) {
+        return 0x48 | (reg >= 8 ? 0x4 : 0) | (rm >= 8 ? 0x1 : 0);
+    }
+
+    // mov r, [rbx + 8 * g]
+    void load_mem(HostReg r, uint8_t g) {
+        bytes({rex(r, 0), 0x8b, static_cast<uint8_t>(0x83 | ((r & 7) << 3))});
+        imm32(g * 8);
+    }
+
+    // mov [rbx + 8 * g], r
+    void store_mem(uint8_t g, HostReg r) {
+        bytes({rex(r, 0), 0x89, static_cast<uint8_t>(0x83 | ((r & 7) << 3))});
+        imm32(g * 8);
+    }
+
+    // mov dst, src
+    void mov_rr(int dst, int src) {
+        bytes({rex(src, dst), 0x89,
+               static_cast<uint8_t>(0xc0 | ((src & 7) << 3) | (dst & 7))});
+    }
+
+    // 读客户机寄存器到临时寄存器，x0 直接清零
+    void load_guest(HostReg r, uint8_t g) {
+        if (g == 0) {
+            bytes({0x31, static_cast<uint8_t>(0xc0 | (r << 3) | r)});
+        } else if (host[g] != IN_MEMORY) {
+            mov_rr(r, host[g]);
+        } else {
+            load_mem(r, g);
+        }
+    }
+
+    // 写客户机寄存器，写 x0（预解码后是丢弃槽位）直接丢弃
+    void store_guest(uint8_t g, HostReg r) {
+        if (g == ZERO_SINK) {
+            return;
+        }
+        if (host[g] != IN_MEMORY) {
+            mov_rr(host[g], r);
+        } else {
+            store_mem(g, r);
+        }
+    }
+
+    // 客户机寄存器 = simm32
+    void store_guest_imm(uint8_t g, int32_t v) {
+        if (g == ZERO_SINK) {
+            return;
+        }
+        if (host[g] != IN_MEMORY) {
+            // mov r64, simm32
+            int r = host[g];
+            bytes({rex(0, r), 0xc7, static_cast<uint8_t>(0xc0 | (r & 7))});
+        } else {
+            bytes({0x48, 0xc7, 0x83});
+            imm32(g * 8);
+        }
+        imm32(static_cast<uint32_t>(v));
+    }
+
+    void mov_imm(HostReg r, uint64_t v) {
+        auto sv = static_cast<int64_t>(v);
+        if (sv == static_cast<int32_t>(sv)) {
+            bytes({0x48, 0xc7, static_cast<uint8_t>(0xc0 | r)});
+            imm32(static_cast<uint32_t>(v));
+        } else {
+            bytes({0x48, static_cast<uint8_t>(0xb8 | r)});
+            imm64(v);
+        }
+    }
+
+    // rax = rax op rcx，opc 为 add/sub/and/or/xor/cmp 的 r/m, r 形式操作码
+    void alu_rr(uint8_t opc, bool wide = true) {
+        if (wide) {
+            bytes({0x48});
+        }
+        bytes({opc, 0xc8});
+    }
+
+    // rax = rax op imm32，ext 为 0x81 组的扩展码
+    void alu_ri(uint8_t ext, int32_t v, bool wide = true) {
+        if (wide) {
+            bytes({0x48});
+        }
+        bytes({0x81, static_cast<uint8_t>(0xc0 | (ext << 3))});
+        imm32(static_cast<uint32_t>(v));
+    }
+
+    // 按 cl 移位，硬件截断移位量的方式与 RISC-V 一致
+    void shift_cl(uint8_t ext, bool wide = true) {
+        if (wide) {
+            bytes({0x48});
+        }
+        bytes({0xd3, static_cast<uint8_t>(0xc0 | (ext << 3))});
+    }
+
+    void shift_imm(uint8_t ext, uint8_t n, bool wide = true) {
+        if (wide) {
+            bytes({0x48});
+        }
+        bytes({0xc1, static_cast<uint8_t>(0xc0 | (ext << 3)), n});
+    }
+
+    // movsxd rax, eax
+    void sext32() {
+        bytes({0x48, 0x63, 0xc0});
+    }
+
+    // setcc al; movzx eax, al
+    void setcc(Cond cc) {
+        bytes({0x0f, static_cast<uint8_t>(0x90 | cc), 0xc0, 0x0f, 0xb6, 0xc0});
+    }
+
+    // 返回 rel32 所在位置，稍后回填
+    size_t jcc(Cond cc) {
+        bytes({0x0f, static_cast<uint8_t>(0x80 | cc)});
+        imm32(0);
+        return pos() - 4;
+    }
+
+    size_t jmp() {
+        bytes({0xe9});
+        imm32(0);
+        return pos() - 4;
+    }
+
+    void patch(size_t at, size_t target) {
+        auto rel = static_cast<uint32_t>(target - (at + 4));
+        std::memcpy(&buf[at], &rel, 4);
+    }
+};
+
+// 0x81/0xc1/0xd3 组的扩展码
+constexpr uint8_t EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_XOR = 6,
+                  EXT_CMP = 7;
+constexpr uint8_t EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7;
+
+// 块内从中间退出的位置：回填的跳转、对应的客户机 pc 以及此前完成的指令数
+struct SideExit {
+    size_t at;
+    uint64_t pc;
+    uint64_t retired;
+};
+
+// 走完整块后跳到静态可知的 target 的出口，回填的跳转
+struct Chain {
+    size_t at;
+    uint64_t target;
+};
+
+// 出口末尾可以链接到目标块的 jmp rel32，back 表示这是回跳
+struct Link {
+    size_t at;
+    uint64_t target;
+    bool back;
+};
+
+class Translator {
+public:
+    Emitter e;
+    std::vector<SideExit> exits;
+    std::vector<Chain> chains;
+    // 已经累加过 instret 的出口，直接跳到写回寄存器的尾声
+    std::vector<size_t> to_writeback;
+
+    // 当前指令之前已完成的指令数
+    uint64_t retired = 0;
+
+    // RAM 的客户机起始地址，编译时作为常量写进生成的代码
+    uint64_t ram_base = 0;
+
+    // 块的入口 pc、整块的指令数，以及块体的起始位置（跳回自身时不经过序言）
+    uint64_t start = 0;
+    uint64_t total = 0;
+    size_t loop_top = 0;
+
+    // 按块内使用次数把客户机寄存器分配到宿主机寄存器，返回被写过的已分配寄存器
+    std::vector<uint8_t> allocate(const Block &block);
+
+    // 翻译一条指令，不支持时返回 false 且不生成任何代码
+    bool emit(const DecodedInst &inst, uint64_t pc);
+
+    // 链入口的预算检查：再走一遍本块会超出 budget 时跳到回填的位置
+    // mov rax, [rdi + 40]; add rax, total; cmp rax, [rdi + 48]; ja over
+    size_t check_budget() {
+        e.bytes({0x48, 0x8b, 0x47, 0x28});
+        e.alu_ri(EXT_ADD, static_cast<int32_t>(total));
+        e.bytes({0x48, 0x3b, 0x47, 0x30});
+        return e.jcc(CC_A);
+    }
+
+    // 计数器加一：mov rax, counter; inc dword [rax]
+    void count(const uint32_t *counter) {
+        e.mov_imm(RAX, reinterpret_cast<uint64_t>(counter));
+        e.bytes({0xff, 0x00});
+    }
+
+private:
+    // rax = rs1 + imm - ram_base，越界时从块中间退出
+    void emit_address(const DecodedInst &inst, uint64_t pc);
+    void emit_load(const DecodedInst &inst, uint64_t pc);
+    void emit_store(const DecodedInst &inst, uint64_t pc);
+    void emit_branch(const DecodedInst &inst, uint64_t pc, Cond cc);
+    void emit_fused(const DecodedInst &inst, uint64_t pc);
+
+    // cmp rax, r14; jae side_exit
+    void check_address(uint64_t pc) {
+        e.bytes({0x4c, 0x39, 0xf0});
+        exits.push_back({e.jcc(CC_AE), pc, retired});
+    }
+
+    // 跳回块的开头：累加一轮的 instret，已分配的寄存器不必写回。
+    // 再走一轮会超出 budget 时停在块的开头返回
+    // add qword [rdi + 40], total
+    // mov rax, [rdi + 40]; add rax, total; cmp rax, [rdi + 48]; jbe loop_top
+    // mov rax, start; jmp epilogue
+    void loop_back() {
+        e.bytes({0x48, 0x81, 0x47, 0x28});
+        e.imm32(static_cast<uint32_t>(total));
+        e.bytes({0x48, 0x8b, 0x47, 0x28});
+        e.alu_ri(EXT_ADD, static_cast<int32_t>(total));
+        e.bytes({0x48, 0x3b, 0x47, 0x30});
+        e.patch(e.jcc(CC_BE), loop_top);
+        e.mov_imm(RAX, start);
+        to_writeback.push_back(e.jmp());
+    }
+
+    // 两个出口：条件成立时到 target，否则到 fallthrough。
+    // 跳回自身的循环留在本地代码里
+    void emit_exits(Cond cc, uint64_t target, uint64_t fallthrough) {
+        if (target == start) {
+            size_t skip = e.jcc(static_cast<Cond>(cc ^ 1));
+            loop_back();
+            e.patch(skip, e.pos());
+        } else {
+            chains.push_back({e.jcc(cc), target});
+        }
+        chains.push_back({e.jmp(), fallthrough});
+    }
+};
+
+void Translator::emit_address(const DecodedInst &inst, uint64_t pc) {
+    e.load_guest(RAX, inst.rs1);
+    if (inst.imm != 0) {
+        e.alu_ri(EXT_ADD, static_cast<int32_t>(inst.imm));
+    }
+    if (ram_base != 0) {
+        e.mov_imm(RCX, ram_base);
+        e.alu_rr(0x29);
+    }
+    check_address(pc);
+}
+
+void Translator::emit_load(const DecodedInst &inst, uint64_t pc) {
+    emit_address(inst, pc);
+    // rcx = [r12 + rax]，按宽度和符号扩展方式选择指令
+    switch (inst.op) {
+    case Op::Lb: e.bytes({0x49, 0x0f, 0xbe, 0x0c, 0x04}); break;
+    case Op::Lbu: e.bytes({0x49, 0x0f, 0xb6, 0x0c, 0x04}); break;
+    case Op::Lh: e.bytes({0x49, 0x0f, 0xbf, 0x0c, 0x04}); break;
+    case Op::Lhu: e.bytes({0x49, 0x0f, 0xb7, 0x0c, 0x04}); break;
+    case Op::Lw: e.bytes({0x49, 0x63, 0x0c, 0x04}); break;
+    case Op::Lwu: e.bytes({0x41, 0x8b, 0x0c, 0x04}); break;
+    default: e.bytes({0x49, 0x8b, 0x0c, 0x04}); break;
+    }
+    e.store_guest(inst.rd, RCX);
+}
+
+void Translator::emit_store(const DecodedInst &inst, uint64_t pc) {
+    emit_address(inst, pc);
+    const uint8_t bytes = inst.op == Op::Sb   ? 1
+                          : inst.op == Op::Sh ? 2
+                          : inst.op == Op::Sw ? 4
+                                              : 8;
+    // 跨页的写入很少见，退出交给解释器，之后只需处理一页
+    // mov ecx, eax; and ecx, 0xfff; cmp ecx, 4096 - bytes; ja side_exit
+    if (bytes > 1) {
+        e.bytes({0x89, 0xc1, 0x81, 0xe1, 0xff, 0x0f, 0x00, 0x00, 0x81, 0xf9});
+        e.imm32(static_cast<uint32_t>((1 << Dram::PAGE_SHIFT) - bytes));
+        exits.push_back({e.jcc(CC_A), pc, retired});
+    }
+    // 写入含有代码的页时退出，由解释器负责使缓存失效
+    // mov rdx, rax; shr rdx, 12; test byte [r13 + rdx], PAGE_CODE; jne side_exit
+    e.bytes({0x48, 0x89, 0xc2, 0x48, 0xc1, 0xea,
+             static_cast<uint8_t>(Dram::PAGE_SHIFT)});
+    e.bytes({0x41, 0xf6, 0x44, 0x15, 0x00, Dram::PAGE_CODE});
+    exits.push_back({e.jcc(CC_NE), pc, retired});
+
+    e.load_guest(RCX, inst.rs2);
+    // [r12 + rax] = rcx
+    switch (inst.op) {
+    case Op::Sb: e.bytes({0x41, 0x88, 0x0c, 0x04}); break;
+    case Op::Sh: e.bytes({0x66, 0x41, 0x89, 0x0c, 0x04}); break;
+    case Op::Sw: e.bytes({0x41, 0x89, 0x0c, 0x04}); break;
+    default: e.bytes({0x49, 0x89, 0x0c, 0x04}); break;
+    }
+
+    // 标记写过的页和脏页：or byte [r13 + rdx], PAGE_WRITTEN
+    e.bytes({0x41, 0x80, 0x4c, 0x15, 0x00, Dram::PAGE_WRITTEN});
+}
+
+void Translator::emit_branch(const DecodedInst &inst, uint64_t pc, Cond cc) {
+    e.load_guest(RAX, inst.rs1);
+    e.load_guest(RCX, inst.rs2);
+    e.alu_rr(0x39);
+    emit_exits(cc, pc + inst.imm, pc + 4);
+}
+
+void Translator::emit_fused(const DecodedInst &inst, uint64_t pc) {
+    switch (inst.op) {
+    case Op::LuiAddi:
+        e.mov_imm(RAX, inst.imm);
+        e.store_guest(inst.rd, RAX);
+        break;
+    case Op::SlliSrli:
+        e.load_guest(RAX, inst.rs1);
+        e.shift_imm(EXT_SHL, static_cast<uint8_t>(inst.imm));
+        e.shift_imm(EXT_SHR, static_cast<uint8_t>(inst.imm2));
+        e.store_guest(inst.rd, RAX);
+        break;
+    case Op::AuipcJalr:
+        e.mov_imm(RCX, pc + inst.imm);
+        e.store_guest(inst.rs1, RCX);
+        e.mov_imm(RCX, pc + 8);
+        e.store_guest(inst.rd, RCX);
+        chains.push_back({e.jmp(), (pc + inst.imm + inst.imm2) & ~uint64_t{1}});
+        break;
+    case Op::AuipcLd:
+        // 地址是常量；越界时退出，解释器会重新执行整条融合指令
+        e.mov_imm(RCX, pc + inst.imm);
+        e.store_guest(inst.rs1, RCX);
+        e.mov_imm(RAX, pc + inst.imm + inst.imm2 - ram_base);
+        check_address(pc);
+        e.bytes({0x49, 0x8b, 0x0c, 0x04});
+        e.store_guest(inst.rd, RCX);
+        break;
+    default: // SltBranch / SltuBranch
+        e.load_guest(RAX, inst.rs1);
+        e.load_guest(RCX, inst.rs2);
+        e.alu_rr(0x39);
+        e.setcc(inst.op == Op::SltBranch ? CC_L : CC_B);
+        e.store_guest(inst.rd, RAX);
+        e.bytes({0x85, 0xc0}); // test eax, eax
+        emit_exits(inst.imm2 ? CC_NE : CC_E, pc + inst.imm, pc + 8);
+        break;
+    }
+}
+
+bool Translator::emit(const DecodedInst &inst, uint64_t pc) {
+    const auto imm32 = static_cast<int32_t>(inst.imm);
+
+    // 二元运算的公共部分：rax = rs1 op (rcx = rs2)
+    auto rr = [&](uint8_t opc, bool wide = true) {
+        e.load_guest(RAX, inst.rs1);
+        e.load_guest(RCX, inst.rs2);
+        e.alu_rr(opc, wide);
+        if (!wide) {
+            e.sext32();
+        }
+        e.store_guest(inst.rd, RAX);
+    };
+    auto ri = [&](uint8_t ext, bool wide = true) {
+        e.load_guest(RAX, inst.rs1);
+        if (imm32 != 0 || ext == EXT_AND) {
+            e.alu_ri(ext, imm32, wide);
+        }
+        if (!wide) {
+            e.sext32();
+        }
+        e.store_guest(inst.rd, RAX);
+    };
+    auto shift_rr = [&](uint8_t ext, bool wide = true) {
+        e.load_guest(RAX, inst.rs1);
+        e.load_guest(RCX, inst.rs2);
+        e.shift_cl(ext, wide);
+        if (!wide) {
+            e.sext32();
+        }
+        e.store_guest(inst.rd, RAX);
+    };
+    auto shift_ri = [&](uint8_t ext, bool wide = true) {
+        e.load_guest(RAX, inst.rs1);
+        e.shift_imm(ext, static_cast<uint8_t>(inst.imm), wide);
+        if (!wide) {
+            e.sext32();
+        }
+        e.store_guest(inst.rd, RAX);
+    };
+    auto compare = [&](Cond cc, bool with_imm) {
+        e.load_guest(RAX, inst.rs1);
+        if (with_imm) {
+            e.alu_ri(EXT_CMP, imm32);
+        } else {
+            e.load_guest(RCX, inst.rs2);
+            e.alu_rr(0x39);
+        }
+        e.setcc(cc);
+        e.store_guest(inst.rd, RAX);
+    };
+
+    switch (inst.op) {
+    case Op::Lui: e.store_guest_imm(inst.rd, imm32); break;
+    case Op::Auipc:
+        e.mov_imm(RAX, pc + inst.imm);
+        e.store_guest(inst.rd, RAX);
+        break;
+    case Op::Jal:
+        e.mov_imm(RCX, pc + 4);
+        e.store_guest(inst.rd, RCX);
+        if (pc + inst.imm == start) {
+            loop_back();
+        } else {
+            chains.push_back({e.jmp(), pc + inst.imm});
+        }
+        break;
+    case Op::Jalr:
+        // 先算目标地址，rd 可能与 rs1 相同
+        e.load_guest(RAX, inst.rs1);
+        if (imm32 != 0) {
+            e.alu_ri(EXT_ADD, imm32);
+        }
+        e.alu_ri(EXT_AND, -2);
+        e.mov_imm(RCX, pc + 4);
+        e.store_guest(inst.rd, RCX);
+        break;
+
+    case Op::Beq: emit_branch(inst, pc, CC_E); break;
+    case Op::Bne: emit_branch(inst, pc, CC_NE); break;
+    case Op::Blt: emit_branch(inst, pc, CC_L); break;
+    case Op::Bge: emit_branch(inst, pc, CC_GE); break;
+    case Op::Bltu: emit_branch(inst, pc, CC_B); break;
+    case Op::Bgeu: emit_branch(inst, pc, CC_AE); break;
+
+    case Op::Lb:
+    case Op::Lh:
+    case Op::Lw:
+    case Op::Ld:
+    case Op::Lbu:
+    case Op::Lhu:
+    case Op::Lwu: emit_load(inst, pc); break;
+    case Op::Sb:
+    case Op::Sh:
+    case Op::Sw:
+    case Op::Sd: emit_store(inst, pc); break;
+
+    case Op::Addi: ri(EXT_ADD); break;
+    case Op::Slti: compare(CC_L, true); break;
+    case Op::Sltiu: compare(CC_B, true); break;
+    case Op::Xori: ri(EXT_XOR); break;
+    case Op::Ori: ri(EXT_OR); break;
+    case Op::Andi: ri(EXT_AND); break;
+    case Op::Slli: shift_ri(EXT_SHL); break;
+    case Op::Srli: shift_ri(EXT_SHR); break;
+    case Op::Srai: shift_ri(EXT_SAR); break;
+
+    case Op::Add: rr(0x01); break;
+    case Op::Sub: rr(0x29); break;
+    case Op::Sll: shift_rr(EXT_SHL); break;
+    case Op::Slt: compare(CC_L, false); break;
+    case Op::Sltu: compare(CC_B, false); break;
+    case Op::Xor: rr(0x31); break;
+    case Op::Srl: shift_rr(EXT_SHR); break;
+    case Op::Sra: shift_rr(EXT_SAR); break;
+    case Op::Or: rr(0x09); break;
+    case Op::And: rr(0x21); break;
+
+    case Op::Addiw: ri(EXT_ADD, false); break;
+    case Op::Slliw: shift_ri(EXT_SHL, false); break;
+    case Op::Srliw: shift_ri(EXT_SHR, false); break;
+    case Op::Sraiw: shift_ri(EXT_SAR, false); break;
+    case Op::Addw: rr(0x01, false); break;
+    case Op::Subw: rr(0x29, false); break;
+    case Op::Sllw: shift_rr(EXT_SHL, false); break;
+    case Op::Srlw: shift_rr(EXT_SHR, false); break;
+    case Op::Sraw: shift_rr(EXT_SAR, false); break;
+
+    case Op::LuiAddi:
+    case Op::AuipcJalr:
+    case Op::AuipcLd:
+    case Op::SlliSrli:
+    case Op::SltBranch:
+    case Op::SltuBranch: emit_fused(inst, pc); break;
+
+    default:
+        // 非法指令等交给解释器
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// 指令读写了哪些客户机寄存器，只用于分配寄存器时的计数
+struct RegUse {
+    bool rs1, rs2, rd;
+};
+
+constexpr RegUse reg_use(Op op) {
+    switch (op) {
+    case Op::Lui:
+    case Op::Auipc:
+    case Op::Jal:
+    case Op::LuiAddi:
+        return {false, false, true};
+    case Op::AuipcJalr:
+    case Op::AuipcLd:
+        // 第一条指令写 rs1
+        return {true, false, true};
+    case Op::Illegal:
+    case Op::Undecoded:
+        return {false, false, false};
+    default:
+        break;
+    }
+    if (is_branch(op) || is_store(op)) {
+        return {true, true, false};
+    }
+    if (is_alu_rr(op) || op == Op::SltBranch || op == Op::SltuBranch) {
+        return {true, true, true};
+    }
+    return {true, false, true};
+}
+
+std::vector<uint8_t> Translator::allocate(const Block &block) {
+    std::array<uint32_t, REG_SLOTS> uses{};
+    std::array<bool, REG_SLOTS> written{};
+    for (const DecodedInst &inst : block.insts) {
+        RegUse use = reg_use(inst.op);
+        if (use.rs1) {
+            uses[inst.rs1]++;
+        }
+        if (use.rs2) {
+            uses[inst.rs2]++;
+        }
+        if (use.rd) {
+            uses[inst.rd]++;
+            written[inst.rd] = true;
+        }
+        if (inst.op == Op::AuipcJalr || inst.op == Op::AuipcLd) {
+            written[inst.rs1] = true;
+        }
+    }
+    uses[0] = 0;
+    uses[ZERO_SINK] = 0;
+
+    // 只用一次的寄存器不值得在入口载入、出口写回
+    std::vector<uint8_t> dirty;
+    for (HostReg r : ALLOCATABLE) {
+        auto best = std::max_element(uses.begin(), uses.end());
+        if (*best < 2) {
+            break;
+        }
+        auto g = static_cast<uint8_t>(best - uses.begin());
+        *best = 0;
+        e.host[g] = static_cast<int8_t>(r);
+        e.load_mem(r, g);
+        if (written[g]) {
+            dirty.push_back(g);
+        }
+    }
+    return dirty;
+}
+
+bool Jit::available() {
+    return true;
+}
+
+JitFn Jit::compile(const Block &block, uint64_t ram_base,
+                   bool allocate_registers) {
+    Translator t;
+    t.ram_base = ram_base;
+    Emitter &e = t.e;
+
+    // instret 由各出口累加：走完整块加 total，中途退出加已完成的部分
+    for (const DecodedInst &inst : block.insts) {
+        t.total += inst_count(inst.op);
+    }
+    t.start = block.start;
+
+    // 保存被调用者保存寄存器，并从 JitContext 载入常驻寄存器
+    e.bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x55, 0x41, 0x57});
+    e.bytes({0x48, 0x8b, 0x1f});       // mov rbx, [rdi]
+    e.bytes({0x4c, 0x8b, 0x67, 0x08}); // mov r12, [rdi + 8]
+    e.bytes({0x4c, 0x8b, 0x6f, 0x10}); // mov r13, [rdi + 16]
+    e.bytes({0x4c, 0x8b, 0x77, 0x18}); // mov r14, [rdi + 24]
+    const size_t skip_chain = e.jmp();
+
+    // 链入口：前一个块走完后直接跳到这里，栈上已经保存了被调用者保存寄存器，
+    // 常驻寄存器也已载入。像调度器一样计数，回跳入口还要计入 loop_hits
+    std::vector<size_t> over_budget;
+    const size_t back_entry = e.pos();
+    over_budget.push_back(t.check_budget());
+    t.count(&block.loop_hits);
+    const size_t skip_check = e.jmp();
+    const size_t chain_entry = e.pos();
+    over_budget.push_back(t.check_budget());
+    e.patch(skip_check, e.pos());
+    t.count(&block.hits);
+    e.patch(skip_chain, e.pos());
+    e.mov_imm(RAX, block.start);
+    e.bytes({0x48, 0x89, 0x47, 0x40}); // mov [rdi + 64], rax
+
+    // 常用的客户机寄存器在整个块内留在宿主机寄存器中，所有出口都经过尾声写回
+    std::vector<uint8_t> dirty;
+    if (allocate_registers) {
+        dirty = t.allocate(block);
+    }
+    t.loop_top = e.pos();
+
+    uint64_t pc = block.start;
+    size_t n = 0;
+    for (const DecodedInst &inst : block.insts) {
+        if (!t.emit(inst, pc)) {
+            break;
+        }
+        n++;
+        pc += 4 * inst_count(inst.op);
+        t.retired += inst_count(inst.op);
+    }
+    if (n == 0) {
+        return nullptr;
+    }
+
+    if (n < block.insts.size()) {
+        // 遇到不支持的指令，从这里退出
+        t.exits.push_back({e.jmp(), pc, t.retired});
+    } else if (!ends_block(block.insts.back().op)) {
+        // 因长度或页边界结束的块，顺序执行下一条
+        t.chains.push_back({e.jmp(), pc});
+    }
+
+    // 只有 jalr 走到这里，目标地址在 rax 中
+    e.bytes({0x48, 0x81, 0x47, 0x28}); // add qword [rdi + 40], total
+    e.imm32(static_cast<uint32_t>(t.total));
+
+    auto write_back = [&] {
+        for (uint8_t g : dirty) {
+            e.store_mem(g, static_cast<HostReg>(e.host[g]));
+        }
+    };
+    std::vector<size_t> to_leave;
+    if (n == block.insts.size() && block.insts.back().op == Op::Jalr) {
+        // 内联缓存，布局见 Jit::IC_TARGET：
+        // movabs rcx, cached; cmp rax, rcx; jne miss; jmp cached_entry
+        // miss: lea rcx, [rip + cache]; mov [rdi + 56], rcx; jmp leave
+        write_back();
+        e.bytes({0x48, 0xb9});
+        const size_t cache = e.pos();
+        e.imm64(IC_EMPTY);
+        e.bytes({0x48, 0x39, 0xc8});
+        const size_t miss = e.jcc(CC_NE);
+        const size_t hit = e.jmp();
+        e.patch(miss, e.pos());
+        e.patch(hit, e.pos());
+        e.bytes({0x48, 0x8d, 0x0d});
+        e.imm32(0);
+        e.patch(e.pos() - 4, cache);
+        e.bytes({0x48, 0x89, 0x4f, 0x38});
+        to_leave.push_back(e.jmp());
+        e.imm64(block.start);
+    }
+    size_t epilogue = e.pos();
+    for (size_t at : t.to_writeback) {
+        e.patch(at, epilogue);
+    }
+    write_back();
+    const size_t leave = e.pos();
+    for (size_t at : to_leave) {
+        e.patch(at, leave);
+    }
+    e.bytes({0x41, 0x5f, 0x5d, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+
+    // 静态目标的出口：累加 instret、写回寄存器后跳到目标块的链入口；
+    // 目标还没有编译时先返回目标地址，编译后再回填
+    std::vector<Link> links;
+    for (const Chain &chain : t.chains) {
+        e.patch(chain.at, e.pos());
+        e.bytes({0x48, 0x81, 0x47, 0x28});
+        e.imm32(static_cast<uint32_t>(t.total));
+        write_back();
+        e.mov_imm(RAX, chain.target);
+        const size_t at = e.jmp();
+        e.patch(at, leave);
+        // 与调度器相同，跳到不在本块之后的位置算作回跳
+        links.push_back({at, chain.target, chain.target <= block.start});
+    }
+
+    // 链入时预算不够，回到调度器从本块开头执行
+    for (size_t at : over_budget) {
+        e.patch(at, e.pos());
+    }
+    e.mov_imm(RAX, block.start);
+    e.patch(e.jmp(), leave);
+
+    // 块中间的出口：side_exit 记下本块，累加已完成的指令数，返回尚未执行的指令地址
+    for (const SideExit &exit : t.exits) {
+        e.patch(exit.at, e.pos());
+        e.mov_imm(RAX, reinterpret_cast<uint64_t>(&block));
+        e.bytes({0x48, 0x89, 0x47, 0x20}); // mov [rdi + 32], rax
+        e.bytes({0x48, 0x81, 0x47, 0x28});
+        e.imm32(static_cast<uint32_t>(exit.retired));
+        e.mov_imm(RAX, exit.pc);
+        e.patch(e.jmp(), epilogue);
+    }
+
+    if (e.buf.size() > MAX_BLOCK_CODE || full()) {
+        return nullptr;
+    }
+    if (code == nullptr) {
+        void *p = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        code = static_cast<uint8_t *>(p);
+    }
+    uint8_t *entry = code + used;
+
+    // 目标已经编译的出口直接链接，其余的等目标编译时回填
+    for (const Link &link : links) {
+        auto it = entries.find(link.target);
+        if (it != entries.end()) {
+            uint8_t *target = link.back ? it->second.back : it->second.chain;
+            e.patch(link.at, static_cast<size_t>(target - entry));
+        } else {
+            unlinked.emplace(link.target,
+                             Pending{entry + link.at, link.back});
+        }
+    }
+    write(entry, e.buf.data(), e.buf.size());
+    used += (e.buf.size() + 15) & ~size_t{15};
+
+    const Entry chain = {entry + back_entry, entry + chain_entry};
+    entries.emplace(block.start, chain);
+    auto [first, last] = unlinked.equal_range(block.start);
+    for (auto it = first; it != last; ++it) {
+        uint8_t *target = it->second.back ? chain.back : chain.chain;
+        const auto rel = static_cast<uint32_t>(target - (it->second.at + 4));
+        write(it->second.at, &rel, 4);
+    }
+    unlinked.erase(first, last);
+
+    return reinterpret_cast<JitFn>(entry);
+}
+
+void Jit::link_indirect(uint8_t *cache, uint64_t pc) {
+    uint8_t patched[IC_TARGET + 4];
+    std::memcpy(patched, cache, sizeof(patched));
+    uint64_t cached;
+    std::memcpy(&cached, patched, 8);
+    auto it = entries.find(pc);
+    if (cached != IC_EMPTY || it == entries.end()) {
+        return;
+    }
+    uint64_t start;
+    std::memcpy(&start, cache + IC_START, 8);
+    uint8_t *target = pc <= start ? it->second.back : it->second.chain;
+    const auto rel = static_cast<uint32_t>(target - (cache + IC_TARGET + 4));
+    std::memcpy(patched, &pc, 8);
+    std::memcpy(patched + IC_TARGET, &rel, 4);
+    write(cache, patched, sizeof(patched));
+}
+
+void Jit::write(uint8_t *at, const void *src, size_t size) {
+    // W^X：只把涉及的页改为可写不可执行，写完后改回可执行不可写
+    const auto first = reinterpret_cast<uintptr_t>(at) & ~(HOST_PAGE - 1);
+    const auto last = reinterpret_cast<uintptr_t>(at) + size;
+    auto *page = reinterpret_cast<void *>(first);
+    mprotect(page, last - first, PROT_READ | PROT_WRITE);
+    std::memcpy(at, src, size);
+    mprotect(page, last - first, PROT_READ | PROT_EXEC);
+}
+
+#else
+
+bool Jit::available() {
+    return false;
+}
+
+JitFn Jit::compile(const Block &, uint64_t, bool) {
+    return nullptr;
+}
+
+void Jit::link_indirect(uint8_t *, uint64_t) {}
+
+#endif
+
+Jit::~Jit() {
+    if (code != nullptr) {
+        munmap(code, CODE_SIZE);
+    }
+}
+
+Jit &Jit::operator=(const Jit &other) {
+    if (this != &other) {
+        reset();
+    }
+    return *this;
+}
+
+Jit::Jit(Jit &&other) noexcept
+    : code(std::exchange(other.code, nullptr)),
+      used(std::exchange(other.used, 0)), entries(std::move(other.entries)),
+      unlinked(std::move(other.unlinked)) {}
+
+Jit &Jit::operator=(Jit &&other) noexcept {
+    std::swap(code, other.code);
+    std::swap(used, other.used);
+    std::swap(entries, other.entries);
+    std::swap(unlinked, other.unlinked);
+    return *this;
+}
@@ -0,0 +1,102 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "block.hh"
+
+// 本地代码运行时的上下文，生成的代码通过固定偏移访问各字段
+struct JitContext {
+    uint64_t *regs;           // 客户机寄存器组 Cpu::regs
+    uint8_t *ram;             // RAM 在宿主机上的起始地址
+    uint8_t *page_flags;      // 每页一个字节的标志，见 Dram::page_flags
+    uint64_t ram_limit;       // 访存快速路径允许的最大偏移（不含）
+    uint64_t side_exit;       // 非0时是中途退出的块（Block *），返回值是未执行指令的 pc
+    uint64_t instret;         // 本次执行完成的指令数
+    uint64_t budget;          // 本次最多完成的指令数，自循环在超过之前退出
+    uint64_t indirect;        // 非0时是未命中的 jalr 内联缓存，见 Jit::link_indirect
+    uint64_t last;            // 最后进入的块的入口 pc
+};
+
+// x86-64 即时编译器：把基本块翻译成本地代码。
+// 不支持的指令处截断，访存越界、写入代码页或跨页写入时从块中间退出，剩余部分交给解释器。
+// 跳到静态目标的出口链接到目标块的本地代码，不回到调度器；目标后编译时再回填跳转。
+// jalr 出口带一个单项的内联缓存，记住第一个已编译的目标。
+// 生成的代码里记着 Block 的地址，丢弃基本块时必须一起 reset
+class Jit {
+public:
+    // 代码缓冲区大小
+    static constexpr size_t CODE_SIZE = 16 << 20;
+
+    // 基本块执行多少次后才编译
+    static constexpr uint32_t DEFAULT_THRESHOLD = 16;
+
+    Jit() = default;
+    ~Jit();
+
+    // 生成的代码属于派生状态，拷贝时从空缓冲区开始
+    Jit(const Jit &) {}
+    Jit &operator=(const Jit &other);
+    Jit(Jit &&other) noexcept;
+    Jit &operator=(Jit &&other) noexcept;
+
+    // 当前平台能否即时编译
+    static bool available();
+
+    // 编译基本块，第一条指令就不支持时返回 nullptr。RAM 的起始地址 ram_base
+    // 作为常量写进代码（为0时省去减法），大小在运行时由 JitContext::ram_limit 给出。
+    // allocate_registers 为 true 时把块内常用的客户机寄存器放在宿主机寄存器中
+    JitFn compile(const Block &block, uint64_t ram_base,
+                  bool allocate_registers = true);
+
+    // jalr 出口的内联缓存未命中、返回 pc 时调用：缓存还空着且 pc 处的块已经编译时，
+    // 把 pc 和它的链入口填进缓存，之后跳到同一目标不再回到调度器
+    void link_indirect(uint8_t *cache, uint64_t pc);
+
+    // 缓冲区是否已满，满了之后需要 reset 并丢弃所有基本块
+    bool full() const {
+        return used + MAX_BLOCK_CODE > CODE_SIZE;
+    }
+
+    // 丢弃所有生成的代码
+    void reset() {
+        used = 0;
+        entries.clear();
+        unlinked.clear();
+    }
+
+private:
+    // 单个基本块生成代码的上限
+    static constexpr size_t MAX_BLOCK_CODE = 64 * 1024;
+    static constexpr uintptr_t HOST_PAGE = 4096;
+
+    // jalr 内联缓存的布局，以缓存的目标 pc（movabs rcx 的立即数）为起点：
+    // 命中时 jmp rel32 的偏移量在 IC_TARGET 处，所在块的入口 pc 在 IC_START 处。
+    // 客户机的 jalr 目标总是偶数，IC_EMPTY 表示缓存还空着
+    static constexpr size_t IC_TARGET = 18;
+    static constexpr size_t IC_START = 38;
+    static constexpr uint64_t IC_EMPTY = 1;
+
+    // 块的链入口：从前一个块回跳过来时进入 back，其余进入 chain
+    struct Entry {
+        uint8_t *back;
+        uint8_t *chain;
+    };
+    // 等待目标块编译后回填的 jmp rel32
+    struct Pending {
+        uint8_t *at;
+        bool back;
+    };
+
+    // 把 size 字节写入代码缓冲区的 at 处
+    void write(uint8_t *at, const void *src, size_t size);
+
+    uint8_t *code = nullptr;
+    size_t used = 0;
+    std::unordered_map<uint64_t, Entry> entries;       // 块入口 pc -> 链入口
+    std::unordered_multimap<uint64_t, Pending> unlinked; // 目标 pc -> 待回填的跳转
+};
+
+#endif
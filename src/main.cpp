@@ -1,55 +1,221 @@
 #include "cpu.hh"
-#include "exception.hh"
+#include "elf.hh"
+#include "uart.hh"
+#include <algorithm>
 #include <cstdint>
-#include <fstream>
 #include <iostream>
-#include <vector>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace {
+
+// 解析地址或大小：十进制或 0x 开头的十六进制，可以带 K/M/G 后缀
+std::optional<uint64_t> parse_size(const std::string &text) {
+    size_t end = 0;
+    uint64_t value = 0;
+    try {
+        value = std::stoull(text, &end, 0);
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+    const std::string suffix = text.substr(end);
+    if (suffix == "K") {
+        return value << 10;
+    } else if (suffix == "M") {
+        return value << 20;
+    } else if (suffix == "G") {
+        return value << 30;
+    } else if (suffix.empty()) {
+        return value;
+    }
+    return std::nullopt;
+}
+
+} // namespace
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    // --step 逐条执行（带调试输出），默认以基本块为单位执行
+    // --engine=<block|threaded|tailcall|jit> 选择基本块的执行引擎
+    // --no-fusion 关闭超级指令融合，--no-trace 关闭轨迹执行层，
+    // --stats 结束时打印指令数、融合和轨迹的统计以及最热的基本块，
+    // --trace-file=<file> 把二进制执行日志写入 file，--trace-level=<trap|block|inst>
+    // 选择记录的详细程度（默认 inst），不能超过编译时的 CRVEMU_TRACE_LEVEL，
+    // --huge-pages=<off|thp|hugetlb> 选择 RAM 的宿主机页大小，结束时报告实际得到的大页，
+    // --machine=virt 使用 RISC-V virt 平台的地址布局（RAM 从 0x80000000 开始），
+    // --ram-base=<addr> / --ram-size=<size> 覆盖 RAM 的位置和大小，大小可以带 K/M/G 后缀
+    bool single_step = false;
+    bool fusion = true;
+    bool tracing = true;
+    bool stats = false;
+    std::string trace_file;
+    TraceLevel trace_level = TraceLevel::Inst;
+    Engine engine = Engine::Block;
+    HugePages huge = HugePages::Off;
+    bool virt = false;
+    std::optional<uint64_t> ram_base;
+    std::optional<uint64_t> ram_size;
+    int argi = 1;
+    for (; argi < argc - 1; argi++) {
+        std::string opt = argv[argi];
+        if (opt == "--step") {
+            single_step = true;
+        } else if (opt == "--engine=block") {
+            engine = Engine::Block;
+        } else if (opt == "--engine=threaded") {
+            engine = Engine::Threaded;
+        } else if (opt == "--engine=tailcall") {
+            engine = Engine::TailCall;
+        } else if (opt == "--engine=jit") {
+            engine = Engine::Jit;
+        } else if (opt == "--no-fusion") {
+            fusion = false;
+        } else if (opt == "--no-trace") {
+            tracing = false;
+        } else if (opt == "--stats") {
+            stats = true;
+        } else if (opt.starts_with("--trace-file=")) {
+            trace_file = opt.substr(opt.find('=') + 1);
+        } else if (opt == "--trace-level=trap") {
+            trace_level = TraceLevel::Trap;
+        } else if (opt == "--trace-level=block") {
+            trace_level = TraceLevel::Block;
+        } else if (opt == "--trace-level=inst") {
+            trace_level = TraceLevel::Inst;
+        } else if (opt == "--huge-pages=off") {
+            huge = HugePages::Off;
+        } else if (opt == "--huge-pages=thp") {
+            huge = HugePages::Transparent;
+        } else if (opt == "--huge-pages=hugetlb") {
+            huge = HugePages::HugeTlb;
+        } else if (opt == "--machine=virt") {
+            virt = true;
+        } else if (opt.starts_with("--ram-base=") &&
+                   (ram_base = parse_size(opt.substr(opt.find('=') + 1)))) {
+            continue;
+        } else if (opt.starts_with("--ram-size=") &&
+                   (ram_size = parse_size(opt.substr(opt.find('=') + 1)))) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    if (argi != argc - 1) {
         std::cout << "Usage:\n"
-                  << "- ./program_name <filename>\n";
+                  << "- ./program_name [--step] "
+                     "[--engine=<block|threaded|tailcall|jit>] [--no-fusion] "
+                     "[--no-trace] [--stats] [--trace-file=<file>] "
+                     "[--trace-level=<trap|block|inst>] "
+                     "[--huge-pages=<off|thp|hugetlb>] [--machine=virt] "
+                     "[--ram-base=<addr>] [--ram-size=<size>] <filename>\n";
         return 0;
     }
+    const char *filename = argv[argi];
+
+    MachineConfig machine = virt ? MachineConfig::virt() : MachineConfig{};
+    machine.ram_base = ram_base.value_or(machine.ram_base);
+    machine.ram_size = ram_size.value_or(machine.ram_size);
+    if (auto error = machine.check()) {
+        std::cerr << "Bad machine description: " << *error << std::endl;
+        return 1;
+    }
 
-    // 默认情况下，文件是以文本模式打开的。在文本模式下，某些字符可能会被转换（例如，在
-    // Windows 系统上，\n 可能会被转换为 \r\n）。 使用 std::ios::binary
-    // 标志可以防止这些转换，确保文件内容按原样读取
-    std::ifstream file(argv[1], std::ios::binary);
+    // ELF 文件按 PT_LOAD 段映射，从 e_entry 开始执行；其他文件作为平面镜像映射到 RAM 开头。
+    // 两者都以写时复制的方式直接映射文件，不读入也不复制，
+    // 客户机访问到哪一页才从页缓存中取出哪一页
+    ElfProgram program;
+    if (is_elf(filename)) {
+        auto elf = load_elf(filename, machine);
+        if (!elf) {
+            std::cerr << elf.error() << std::endl;
+            return 1;
+        }
+        program = std::move(*elf);
+    } else {
+        program.image = GuestImage::open(filename);
+        program.entry = machine.ram_base;
+    }
 
     // 打开文件失败
-    if (!file) {
-        std::cerr << "Cannot open file: " << argv[1] << std::endl;
+    if (!program.image) {
+        std::cerr << "Cannot open file: " << filename << std::endl;
         return 1;
     }
 
-    // 用elf文件中的内存初始化code
-    std::vector<uint8_t> code(std::istreambuf_iterator<char>(file), {});
-    Cpu cpu(code);
-
-    // 执行完内存所有指令，其中sizeof(cpu.dram[0])是每条指令的字长
+    // 分配 RAM 或映射镜像失败（RAM 太大、读不出镜像、镜像被截短）时报告错误
+    std::optional<Cpu> loaded;
     try {
-        /* code */
-        while (true) {
-            auto inst = cpu.fetch();
-            if (inst.has_value()) {
-                auto next_pc = cpu.execute(inst.value());
-                if (next_pc.has_value()) {
-                    cpu.pc = next_pc.value();
-                } else {
-                    break;
-                }
-            } else {
-                break;
-            }
+        loaded.emplace(Bus{machine, program.image, huge});
+    } catch (const std::exception &e) {
+        std::cerr << "Cannot load " << filename << ": " << e.what()
+                  << std::endl;
+        return 1;
+    }
+    Cpu &cpu = *loaded;
+    // 机器描述里有串口窗口时挂上串口，输出到标准输出。
+    // 有窗口却挂不上时客户机的输出会丢失，按错误处理
+    const bool has_uart =
+        std::ranges::any_of(machine.devices, [](const DeviceWindow &w) {
+            return w.name == "uart";
+        });
+    if (!cpu.bus.attach("uart", std::make_shared<Uart>()) && has_uart) {
+        std::cerr << "Cannot attach uart to its window" << std::endl;
+        return 1;
+    }
+    cpu.pc = program.entry;
+    cpu.engine = engine;
+    cpu.fusion = fusion;
+    cpu.tracing = tracing;
+    std::unique_ptr<TraceSink> sink;
+    if (!trace_file.empty()) {
+        sink = std::make_unique<TraceSink>(trace_file, trace_level);
+        if (!sink->is_open()) {
+            std::cerr << "Cannot open trace file: " << trace_file << std::endl;
+            return 1;
         }
+        cpu.trace_sink = sink.get();
+    }
 
-    } catch (const Exception &e) {
-        std::cerr << "Exception main: " << e << std::endl;
+    // 执行到异常或非法指令为止；逐条执行时每次只完成一条指令
+    StopReason reason;
+    if (single_step) {
+        do {
+            std::cout << "Executing instruction at 0x" << std::hex << cpu.pc
+                      << std::dec << std::endl;
+        } while ((reason = cpu.run(1)) == StopReason::Budget);
+    } else {
+        reason = cpu.run();
+    }
+    if (reason == StopReason::Trap) {
+        std::cerr << "Exception run : " << *cpu.trap << std::endl;
     }
 
     // 打印寄存器和PC状态
     cpu.dump_registers();
     cpu.dump_pc();
+    if (huge != HugePages::Off) {
+        const char *names[] = {"off", "thp", "hugetlb"};
+        std::cout << "Huge pages: requested "
+                  << names[static_cast<int>(huge)] << ", got "
+                  << names[static_cast<int>(cpu.bus.huge_pages())] << ", "
+                  << (cpu.bus.huge_page_bytes() >> 20)
+                  << " MiB of RAM backed" << std::endl;
+    }
+    if (stats) {
+        std::cout << "Instructions retired: " << cpu.instret << std::endl;
+        cpu.fusion_stats.dump();
+        cpu.trace_stats.dump();
+        std::cout << "Hottest blocks:" << std::endl;
+        for (const Block *block : cpu.block_cache().hottest(10)) {
+            std::cout << "  0x" << std::hex << block->start << std::dec;
+            if (const ElfSymbol *sym = program.symbol_at(block->start)) {
+                std::cout << " <" << sym->name << "+0x" << std::hex
+                          << block->start - sym->addr << std::dec << ">";
+            }
+            std::cout << ": " << block->hits << " runs, " << block->loop_hits
+                      << " back edges" << (block->trace ? ", trace" : "")
+                      << std::endl;
+        }
+    }
     return 0;
 }
@@ -0,0 +1,43 @@
+#include "param.hh"
+
+MachineConfig MachineConfig::virt(uint64_t ram_size) {
+    MachineConfig machine;
+    machine.ram_base = 0x8000'0000;
+    machine.ram_size = ram_size;
+    machine.devices = {
+        {"clint", 0x0200'0000, 0x1'0000},
+        {"plic", 0x0c00'0000, 0x400'0000},
+        {"uart", 0x1000'0000, 0x1000},
+    };
+    return machine;
+}
+
+std::optional<std::string> MachineConfig::check() const {
+    if (ram_size == 0 || ram_size % PAGE_SIZE != 0 ||
+        ram_base % PAGE_SIZE != 0) {
+        return "RAM base and size must be non-zero multiples of 4KiB";
+    }
+    if (ram_base + ram_size < ram_base) {
+        return "RAM wraps around the address space";
+    }
+    // 把 RAM 也当作一个窗口，两两检查是否重叠
+    std::vector<DeviceWindow> windows = devices;
+    windows.push_back({"ram", ram_base, ram_size});
+    for (size_t i = 0; i < windows.size(); i++) {
+        const DeviceWindow &a = windows[i];
+        if (a.size == 0 || a.base + a.size < a.base) {
+            return "bad window for " + a.name;
+        }
+        // 总线按页分派设备，窗口不按页对齐就可能与别的窗口共用一页
+        if (a.base % PAGE_SIZE != 0 || a.size % PAGE_SIZE != 0) {
+            return "window for " + a.name + " is not 4KiB-aligned";
+        }
+        for (size_t j = 0; j < i; j++) {
+            const DeviceWindow &b = windows[j];
+            if (a.base < b.base + b.size && b.base < a.base + a.size) {
+                return a.name + " overlaps " + b.name;
+            }
+        }
+    }
+    return std::nullopt;
+}
@@ -2,14 +2,53 @@
 #define PARAM_H
 
 #include <cstddef> // 引入定义 std::size_t 的头文件
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
 
-// 定义DRAM的基地址
+// 默认机器的 DRAM 基地址。实际使用的地址由 MachineConfig 在启动时决定
 constexpr std::size_t DRAM_BASE = 0;
 
-// 定义DRAM的大小为128MB
+// 默认机器的 DRAM 大小为128MB
 constexpr std::size_t DRAM_SIZE = 1024 * 1024 * 128;
 
-// 定义DRAM的结束地址
+// 默认机器的 DRAM 结束地址
 constexpr std::size_t DRAM_END = DRAM_SIZE + DRAM_BASE - 1;
 
-#endif
\ No newline at end of file
+// 客户机物理地址空间中留给一个设备的窗口（MMIO），按页对齐，不能与 RAM 或其他窗口重叠
+struct DeviceWindow {
+    std::string name;
+    uint64_t base;
+    uint64_t size;
+};
+
+// 机器描述：RAM 的位置和大小以及各设备窗口，在启动时选定，创建 Bus 之后不再改变。
+// 默认值就是原来的固定布局：从0开始的 128MiB RAM，没有设备
+struct MachineConfig {
+    static constexpr uint64_t PAGE_SIZE = 4096;
+
+    uint64_t ram_base = DRAM_BASE;
+    uint64_t ram_size = DRAM_SIZE;
+    std::vector<DeviceWindow> devices;
+
+    // RAM 的结束地址（不含）
+    uint64_t ram_end() const {
+        return ram_base + ram_size;
+    }
+
+    // addr 是否落在 RAM 中
+    bool in_ram(uint64_t addr) const {
+        return addr - ram_base < ram_size;
+    }
+
+    // 标准 RISC-V virt 平台的布局：RAM 从 0x8000_0000 开始，
+    // 下面是 CLINT、PLIC 和 UART 的窗口
+    static MachineConfig virt(uint64_t ram_size = DRAM_SIZE);
+
+    // 检查布局是否合法：RAM 和各设备窗口非空且按页对齐，不越界、互不重叠。
+    // 合法时返回 std::nullopt，否则返回错误信息
+    std::optional<std::string> check() const;
+};
+
+#endif
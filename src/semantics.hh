@@ -0,0 +1,189 @@
+#ifndef SEMANTICS_H
+#define SEMANTICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "decode.hh"
+
+// 指令按执行方式分组，各解释器核心用这些列表展开各自的处理函数
+#define BRANCH_OPS(X) X(Beq) X(Bne) X(Blt) X(Bge) X(Bltu) X(Bgeu)
+#define LOAD_OPS(X) X(Lb) X(Lh) X(Lw) X(Ld) X(Lbu) X(Lhu) X(Lwu)
+#define STORE_OPS(X) X(Sb) X(Sh) X(Sw) X(Sd)
+// 第二个操作数为立即数
+#define ALU_RI_OPS(X)                                                          \
+    X(Addi) X(Slti) X(Sltiu) X(Xori) X(Ori) X(Andi) X(Slli) X(Srli) X(Srai)    \
+    X(Addiw) X(Slliw) X(Srliw) X(Sraiw)
+// 第二个操作数为 rs2
+#define ALU_RR_OPS(X)                                                          \
+    X(Add) X(Sub) X(Sll) X(Slt) X(Sltu) X(Xor) X(Srl) X(Sra) X(Or) X(And)      \
+    X(Addw) X(Subw) X(Sllw) X(Srlw) X(Sraw)
+#define FUSED_OPS(X)                                                           \
+    X(LuiAddi) X(AuipcJalr) X(AuipcLd) X(SlliSrli) X(SltBranch) X(SltuBranch)
+
+// 按上面的分组判断指令类别
+#define OP_CASE(name) case Op::name:
+constexpr bool is_branch(Op op) {
+    switch (op) {
+        BRANCH_OPS(OP_CASE)
+        return true;
+    default:
+        return false;
+    }
+}
+constexpr bool is_load(Op op) {
+    switch (op) {
+        LOAD_OPS(OP_CASE)
+        return true;
+    default:
+        return false;
+    }
+}
+constexpr bool is_store(Op op) {
+    switch (op) {
+        STORE_OPS(OP_CASE)
+        return true;
+    default:
+        return false;
+    }
+}
+constexpr bool is_alu_ri(Op op) {
+    switch (op) {
+        ALU_RI_OPS(OP_CASE)
+        return true;
+    default:
+        return false;
+    }
+}
+constexpr bool is_alu_rr(Op op) {
+    switch (op) {
+        ALU_RR_OPS(OP_CASE)
+        return true;
+    default:
+        return false;
+    }
+}
+constexpr bool is_fused(Op op) {
+    switch (op) {
+        FUSED_OPS(OP_CASE)
+        return true;
+    default:
+        return false;
+    }
+}
+#undef OP_CASE
+
+// 一条（融合）指令对应的客户机指令条数，用于推进 pc 和 instret
+constexpr uint64_t inst_count(Op op) {
+    return is_fused(op) ? 2 : 1;
+}
+
+// 字运算的结果截断为32位后再符号扩展
+constexpr uint64_t sext32(uint64_t v) {
+    return static_cast<int64_t>(static_cast<int32_t>(v));
+}
+
+// 寄存器组在 x0..x31 之后还有一个丢弃槽位。预解码时把写 x0 的 rd 换成它，
+// regs[0] 从不被写入，读 x0 总是得到0，执行时不必每条指令都把 x0 清零
+constexpr uint8_t ZERO_SINK = 32;
+constexpr size_t REG_SLOTS = 33;
+
+constexpr DecodedInst sink_x0(DecodedInst d) {
+    if (d.rd == 0) {
+        d.rd = ZERO_SINK;
+    }
+    return d;
+}
+
+// 运算类指令的语义，a 为 rs1，b 为 rs2 或立即数
+template <Op op> constexpr uint64_t alu(uint64_t a, uint64_t b) {
+    const auto sa = static_cast<int64_t>(a);
+    const auto sb = static_cast<int64_t>(b);
+    if constexpr (op == Op::Addi || op == Op::Add) {
+        return a + b;
+    } else if constexpr (op == Op::Sub) {
+        return a - b;
+    } else if constexpr (op == Op::Slti || op == Op::Slt) {
+        return sa < sb;
+    } else if constexpr (op == Op::Sltiu || op == Op::Sltu) {
+        return a < b;
+    } else if constexpr (op == Op::Xori || op == Op::Xor) {
+        return a ^ b;
+    } else if constexpr (op == Op::Ori || op == Op::Or) {
+        return a | b;
+    } else if constexpr (op == Op::Andi || op == Op::And) {
+        return a & b;
+    } else if constexpr (op == Op::Slli || op == Op::Sll) {
+        return a << (b & 0x3f);
+    } else if constexpr (op == Op::Srli || op == Op::Srl) {
+        return a >> (b & 0x3f);
+    } else if constexpr (op == Op::Srai || op == Op::Sra) {
+        return sa >> (b & 0x3f);
+    } else if constexpr (op == Op::Addiw || op == Op::Addw) {
+        return sext32(a + b);
+    } else if constexpr (op == Op::Subw) {
+        return sext32(a - b);
+    } else if constexpr (op == Op::Slliw || op == Op::Sllw) {
+        return sext32(static_cast<uint32_t>(a) << (b & 0x1f));
+    } else if constexpr (op == Op::Srliw || op == Op::Srlw) {
+        return sext32(static_cast<uint32_t>(a) >> (b & 0x1f));
+    } else {
+        static_assert(op == Op::Sraiw || op == Op::Sraw);
+        return static_cast<int64_t>(static_cast<int32_t>(a) >> (b & 0x1f));
+    }
+}
+
+// 分支是否跳转
+template <Op op> constexpr bool taken(uint64_t a, uint64_t b) {
+    if constexpr (op == Op::Beq) {
+        return a == b;
+    } else if constexpr (op == Op::Bne) {
+        return a != b;
+    } else if constexpr (op == Op::Blt) {
+        return static_cast<int64_t>(a) < static_cast<int64_t>(b);
+    } else if constexpr (op == Op::Bge) {
+        return static_cast<int64_t>(a) >= static_cast<int64_t>(b);
+    } else if constexpr (op == Op::Bltu) {
+        return a < b;
+    } else {
+        static_assert(op == Op::Bgeu);
+        return a >= b;
+    }
+}
+
+// 访存宽度（位）
+template <Op op> constexpr uint64_t mem_bits() {
+    if constexpr (op == Op::Lb || op == Op::Lbu || op == Op::Sb) {
+        return 8;
+    } else if constexpr (op == Op::Lh || op == Op::Lhu || op == Op::Sh) {
+        return 16;
+    } else if constexpr (op == Op::Lw || op == Op::Lwu || op == Op::Sw) {
+        return 32;
+    } else {
+        return 64;
+    }
+}
+
+// 访存的数据类型，与 mem_bits 对应
+template <Op op>
+using mem_word = std::conditional_t<
+    mem_bits<op>() == 8, uint8_t,
+    std::conditional_t<mem_bits<op>() == 16, uint16_t,
+                       std::conditional_t<mem_bits<op>() == 32, uint32_t,
+                                          uint64_t>>>;
+
+// 读出的数据按指令要求扩展到64位
+template <Op op> constexpr uint64_t load_extend(uint64_t v) {
+    if constexpr (op == Op::Lb) {
+        return static_cast<int64_t>(static_cast<int8_t>(v));
+    } else if constexpr (op == Op::Lh) {
+        return static_cast<int64_t>(static_cast<int16_t>(v));
+    } else if constexpr (op == Op::Lw) {
+        return static_cast<int64_t>(static_cast<int32_t>(v));
+    } else {
+        return v;
+    }
+}
+
+#endif
@@ -0,0 +1,137 @@
+#include "cpu.hh"
+#include "semantics.hh"
+
+// 保证尾调用：clang 支持 musttail，GCC 在开启优化时同样会把这里的调用编译为跳转。
+// 基本块最多 MAX_BLOCK_INSTS 条指令，即使没有尾调用优化，调用深度也是有界的
+#if defined(__has_cpp_attribute)
+#if __has_cpp_attribute(clang::musttail)
+#define MUSTTAIL [[clang::musttail]]
+#endif
+#endif
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
+
+// 尾调用解释器核心：每条指令的处理程序是一个独立的小函数，末尾以尾调用跳到下一条的处理程序。
+// 解释器状态（当前指令、寄存器组、pc、块末尾、已完成的指令数）作为参数始终留在宿主机寄存器中
+struct TailCall {
+    using Handler = bool (*)(Cpu &cpu, const DecodedInst *ip, uint64_t *x,
+                             uint64_t pc, const DecodedInst *end, uint64_t n);
+
+    template <Op op>
+    static bool handler(Cpu &cpu, const DecodedInst *ip, uint64_t *x,
+                        uint64_t pc, const DecodedInst *end, uint64_t n);
+
+    static const Handler table[];
+
+    // 离开块时写回 pc 和 instret
+    static bool leave(Cpu &cpu, uint64_t pc, uint64_t n, bool ok = true) {
+        cpu.pc = pc;
+        cpu.instret += n;
+        return ok;
+    }
+
+    // 顺序执行下一条指令，到达块末尾时写回 pc
+    static bool next(Cpu &cpu, const DecodedInst *ip, uint64_t *x, uint64_t pc,
+                     const DecodedInst *end, uint64_t n) {
+        pc += 4;
+        n++;
+        if (++ip == end) {
+            return leave(cpu, pc, n);
+        }
+        MUSTTAIL return table[static_cast<size_t>(ip->op)](cpu, ip, x, pc, end,
+                                                           n);
+    }
+};
+
+template <Op op>
+bool TailCall::handler(Cpu &cpu, const DecodedInst *ip, uint64_t *x,
+                       uint64_t pc, const DecodedInst *end, uint64_t n) {
+    const auto imm = static_cast<uint64_t>(ip->imm);
+    if constexpr (op == Op::Lui) {
+        x[ip->rd] = imm;
+    } else if constexpr (op == Op::Auipc) {
+        x[ip->rd] = pc + imm;
+    } else if constexpr (op == Op::Jal) {
+        x[ip->rd] = pc + 4;
+        return leave(cpu, pc + imm, n + 1);
+    } else if constexpr (op == Op::Jalr) {
+        uint64_t target = (x[ip->rs1] + imm) & ~uint64_t{1};
+        x[ip->rd] = pc + 4;
+        return leave(cpu, target, n + 1);
+    } else if constexpr (is_branch(op)) {
+        return leave(cpu,
+                     taken<op>(x[ip->rs1], x[ip->rs2]) ? pc + imm : pc + 4,
+                     n + 1);
+    } else if constexpr (is_load(op)) {
+        cpu.pc = pc;
+        auto value = cpu.load<mem_word<op>>(x[ip->rs1] + imm);
+        if (!value.has_value()) {
+            return leave(cpu, pc, n, false);
+        }
+        x[ip->rd] = load_extend<op>(value.value());
+    } else if constexpr (is_store(op)) {
+        if (!cpu.store<mem_word<op>>(x[ip->rs1] + imm, x[ip->rs2])) {
+            return leave(cpu, pc, n, false);
+        }
+        // 写入代码页后当前块可能已被释放，立即返回
+        if (cpu.code_modified) {
+            return leave(cpu, pc + 4, n + 1);
+        }
+    } else if constexpr (is_alu_ri(op)) {
+        x[ip->rd] = alu<op>(x[ip->rs1], imm);
+    } else if constexpr (is_alu_rr(op)) {
+        x[ip->rd] = alu<op>(x[ip->rs1], x[ip->rs2]);
+    } else if constexpr (is_fused(op)) {
+        // 融合指令，执行效果与依次执行原来的两条指令相同。
+        // auipc+ld 的 ld 可能出错，等读出之后再计数
+        if constexpr (op != Op::AuipcLd) {
+            cpu.fusion_stats.executed[FusionStats::kind(op)]++;
+        }
+        if constexpr (op == Op::LuiAddi) {
+            x[ip->rd] = imm;
+        } else if constexpr (op == Op::SlliSrli) {
+            x[ip->rd] = (x[ip->rs1] << imm) >> ip->imm2;
+        } else if constexpr (op == Op::AuipcJalr) {
+            x[ip->rs1] = pc + imm;
+            x[ip->rd] = pc + 8;
+            return leave(cpu, (pc + imm + ip->imm2) & ~uint64_t{1}, n + 2);
+        } else if constexpr (op == Op::AuipcLd) {
+            x[ip->rs1] = pc + imm;
+            cpu.pc = pc + 4;
+            auto value = cpu.load<uint64_t>(pc + imm + ip->imm2);
+            if (!value.has_value()) {
+                // auipc 已经完成，停在出错的 ld 上
+                return leave(cpu, pc + 4, n + 1, false);
+            }
+            x[ip->rd] = value.value();
+            cpu.fusion_stats.executed[FusionStats::kind(op)]++;
+        } else {
+            static_assert(op == Op::SltBranch || op == Op::SltuBranch);
+            uint64_t cond = op == Op::SltBranch
+                                ? alu<Op::Slt>(x[ip->rs1], x[ip->rs2])
+                                : alu<Op::Sltu>(x[ip->rs1], x[ip->rs2]);
+            x[ip->rd] = cond;
+            return leave(cpu,
+                         (cond != 0) == (ip->imm2 != 0) ? pc + imm : pc + 8,
+                         n + 2);
+        }
+        // 第二条指令由 next 推进
+        pc += 4;
+        n++;
+    } else {
+        cpu.trap = Exception(Exception::Type::IllegalInstruction, ip->raw);
+        return leave(cpu, pc, n, false);
+    }
+    MUSTTAIL return next(cpu, ip, x, pc, end, n);
+}
+
+#define HANDLER(name) &TailCall::handler<Op::name>,
+const TailCall::Handler TailCall::table[] = {OP_LIST(HANDLER)};
+#undef HANDLER
+
+bool Cpu::run_block_tailcall(const Block &block) {
+    const DecodedInst *ip = block.insts.data();
+    return TailCall::table[static_cast<size_t>(ip->op)](
+        *this, ip, regs.data(), pc, ip + block.insts.size(), 0);
+}
@@ -0,0 +1,226 @@
+#include "cpu.hh"
+#include "semantics.hh"
+
+#if defined(CRVEMU_THREADED_DISPATCH)
+
+// 线索化解释器核心：分派表存放各处理程序的标签地址（GCC/Clang 的 computed goto），
+// 每个处理程序末尾都复制一份分派跳转，间接跳转分散到各处，宿主机的分支预测更准。
+// 执行 [begin, end) 中的指令。in_trace 时这是轨迹：块末的控制转移与下一条指令的地址比较，
+// 相同就接着分派，走到末尾回到开头，直到守卫失败或再走一遍会超过 limit
+template <bool in_trace>
+bool Cpu::run_threaded(const DecodedInst *begin, const DecodedInst *end,
+                       const Trace *trace, uint64_t limit, TraceExit *exit) {
+#define LABEL(name) &&op_##name,
+    static void *const labels[] = {OP_LIST(LABEL)};
+#undef LABEL
+
+    const DecodedInst *ip = begin;
+    uint64_t *const x = regs.data();
+    uint64_t cur = pc;  // 当前指令的地址
+    uint64_t n = 0;     // 已完成的指令数，退出时累加到 instret
+    uint64_t wraps = 0; // 从轨迹末尾回到开头的次数
+
+    // 离开轨迹时记下走到的位置，由调用者补记各块的执行次数
+#define LEAVE()                                                                \
+    do {                                                                       \
+        if constexpr (in_trace) {                                              \
+            exit->wraps = wraps;                                               \
+            exit->last = static_cast<size_t>(ip - begin);                      \
+        }                                                                      \
+    } while (0)
+
+#define DISPATCH() goto *labels[static_cast<size_t>(ip->op)]
+#define NEXT()                                                                 \
+    do {                                                                       \
+        cur += 4;                                                              \
+        n++;                                                                   \
+        if (++ip == end) {                                                     \
+            goto done;                                                         \
+        }                                                                      \
+        DISPATCH();                                                            \
+    } while (0)
+    // 跳转类指令总是基本块的最后一条
+#define JUMP(target)                                                           \
+    do {                                                                       \
+        cur = (target);                                                        \
+        n++;                                                                   \
+        goto done;                                                             \
+    } while (0)
+    // 融合指令先记上第一条指令
+#define FUSED()                                                                \
+    do {                                                                       \
+        fusion_stats.executed[FusionStats::kind(ip->op)]++;                    \
+        cur += 4;                                                              \
+        n++;                                                                   \
+    } while (0)
+
+    DISPATCH();
+
+op_Undecoded:
+op_Illegal:
+    pc = cur;
+    instret += n;
+    LEAVE();
+    trap = Exception(Exception::Type::IllegalInstruction, ip->raw);
+    return false;
+
+op_Lui:
+    x[ip->rd] = ip->imm;
+    NEXT();
+op_Auipc:
+    x[ip->rd] = cur + ip->imm;
+    NEXT();
+op_Jal:
+    x[ip->rd] = cur + 4;
+    JUMP(cur + ip->imm);
+op_Jalr: {
+    uint64_t target = (x[ip->rs1] + ip->imm) & ~uint64_t{1};
+    x[ip->rd] = cur + 4;
+    JUMP(target);
+}
+
+#define BRANCH(name)                                                           \
+    op_##name : JUMP(taken<Op::name>(x[ip->rs1], x[ip->rs2]) ? cur + ip->imm   \
+                                                             : cur + 4);
+    BRANCH_OPS(BRANCH)
+#undef BRANCH
+
+#define LOAD(name)                                                             \
+    op_##name : {                                                              \
+        pc = cur;                                                              \
+        auto value = load<mem_word<Op::name>>(x[ip->rs1] + ip->imm);           \
+        if (!value.has_value()) {                                              \
+            instret += n;                                                      \
+            LEAVE();                                                           \
+            return false;                                                      \
+        }                                                                      \
+        x[ip->rd] = load_extend<Op::name>(value.value());                      \
+    }                                                                          \
+    NEXT();
+    LOAD_OPS(LOAD)
+#undef LOAD
+
+    // 写入代码页后当前块可能已被释放，立即返回
+#define STORE(name)                                                            \
+    op_##name : if (!store<mem_word<Op::name>>(x[ip->rs1] + ip->imm,          \
+                                               x[ip->rs2])) {                  \
+        pc = cur;                                                              \
+        instret += n;                                                          \
+        LEAVE();                                                               \
+        return false;                                                          \
+    }                                                                          \
+    if (code_modified) {                                                       \
+        pc = cur + 4;                                                          \
+        instret += n + 1;                                                      \
+        LEAVE();                                                               \
+        return true;                                                           \
+    }                                                                          \
+    NEXT();
+    STORE_OPS(STORE)
+#undef STORE
+
+#define ALU_RI(name)                                                           \
+    op_##name : x[ip->rd] = alu<Op::name>(x[ip->rs1], ip->imm);                \
+    NEXT();
+    ALU_RI_OPS(ALU_RI)
+#undef ALU_RI
+
+#define ALU_RR(name)                                                           \
+    op_##name : x[ip->rd] = alu<Op::name>(x[ip->rs1], x[ip->rs2]);             \
+    NEXT();
+    ALU_RR_OPS(ALU_RR)
+#undef ALU_RR
+
+    // 融合指令，执行效果与依次执行原来的两条指令相同
+op_LuiAddi:
+    x[ip->rd] = ip->imm;
+    FUSED();
+    NEXT();
+op_SlliSrli:
+    x[ip->rd] = (x[ip->rs1] << ip->imm) >> ip->imm2;
+    FUSED();
+    NEXT();
+op_AuipcJalr:
+    x[ip->rs1] = cur + ip->imm;
+    x[ip->rd] = cur + 8;
+    FUSED();
+    JUMP((cur - 4 + ip->imm + ip->imm2) & ~uint64_t{1});
+op_AuipcLd: {
+    x[ip->rs1] = cur + ip->imm;
+    auto value = load<uint64_t>(cur + ip->imm + ip->imm2);
+    // auipc 已经完成。ld 出错时停在 ld 上，这一对不算执行过，不用 FUSED 计数
+    cur += 4;
+    n++;
+    if (!value.has_value()) {
+        pc = cur;
+        instret += n;
+        LEAVE();
+        return false;
+    }
+    x[ip->rd] = value.value();
+    fusion_stats.executed[FusionStats::kind(ip->op)]++;
+}
+    NEXT();
+op_SltBranch:
+op_SltuBranch: {
+    uint64_t cond = ip->op == Op::SltBranch
+                        ? alu<Op::Slt>(x[ip->rs1], x[ip->rs2])
+                        : alu<Op::Sltu>(x[ip->rs1], x[ip->rs2]);
+    x[ip->rd] = cond;
+    uint64_t target = (cond != 0) == (ip->imm2 != 0) ? cur + ip->imm : cur + 8;
+    FUSED();
+    JUMP(target);
+}
+
+done:
+    if constexpr (in_trace) {
+        // 守卫：走向与记录时相同，并且再走一遍也不会超过 limit 时留在轨迹里
+        const DecodedInst *next = ip + 1 == end ? begin : ip + 1;
+        if (cur == trace->pcs[next - begin]) {
+            if (instret + n + trace->length <= limit) {
+                wraps += next == begin;
+                ip = next;
+                DISPATCH();
+            }
+        } else {
+            trace_stats.exits++;
+        }
+    }
+    pc = cur;
+    instret += n;
+    LEAVE();
+    return true;
+
+#undef FUSED
+#undef JUMP
+#undef NEXT
+#undef DISPATCH
+#undef LEAVE
+}
+
+bool Cpu::run_block_threaded(const Block &block) {
+    return run_threaded<false>(block.insts.data(),
+                               block.insts.data() + block.insts.size(),
+                               nullptr, 0, nullptr);
+}
+
+bool Cpu::run_trace_threaded(const Trace &trace, uint64_t limit,
+                             TraceExit &exit) {
+    return run_threaded<true>(trace.insts.data(),
+                              trace.insts.data() + trace.insts.size(), &trace,
+                              limit, &exit);
+}
+
+#else
+
+// 未开启 CRVEMU_THREADED_DISPATCH 时退回 switch 核心
+bool Cpu::run_block_threaded(const Block &block) {
+    return run_block(block);
+}
+
+bool Cpu::run_trace_threaded(const Trace &trace, uint64_t limit,
+                             TraceExit &exit) {
+    return run_trace_switch(trace, limit, exit);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include <iostream>
+
+#include "block.hh"
+#include "trace.hh"
+
+std::unique_ptr<Trace> make_trace(const std::vector<Block *> &path) {
+    auto trace = std::make_unique<Trace>();
+    trace->head = path.front()->start;
+    const Block *prev = path.back();
+    for (Block *block : path) {
+        trace->blocks.push_back(
+            {trace->insts.size(), block, block->start <= prev->start});
+        uint64_t pc = block->start;
+        for (const DecodedInst &inst : block->insts) {
+            trace->insts.push_back(inst);
+            trace->pcs.push_back(pc);
+            pc += 4 * inst_count(inst.op);
+        }
+        trace->length += (block->end - block->start) / 4;
+        prev = block;
+    }
+    return trace;
+}
+
+uint64_t Trace::account(const TraceExit &exit) const {
+    uint64_t last_start = head;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const Entry &entry = blocks[i];
+        // 循环头的第一次进入不在这里计数，之后每绕一圈进入一次；
+        // 其余的块每圈进入一次，最后一圈只算走到了的块
+        uint64_t runs = exit.wraps;
+        if (i != 0 && entry.first <= exit.last) {
+            runs++;
+        }
+        if (entry.first <= exit.last) {
+            last_start = entry.block->start;
+        }
+        entry.block->hits += static_cast<uint32_t>(runs);
+        if (entry.back) {
+            entry.block->loop_hits += static_cast<uint32_t>(runs);
+        }
+    }
+    return last_start;
+}
+
+void TraceStats::dump() const {
+    std::cout << "Traces: " << recorded << " recorded, " << aborted
+              << " aborted, " << entered << " entered, " << exits
+              << " side exits" << std::endl;
+}
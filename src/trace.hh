@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "decode.hh"
+
+struct Block;
+
+// 离开轨迹时走到的位置：从末尾回到开头的次数，以及最后执行的指令下标
+struct TraceExit {
+    uint64_t wraps = 0;
+    size_t last = 0;
+};
+
+// 轨迹（超级块）：从循环头开始，沿实际执行过的路径把若干基本块首尾相连，
+// 由线索化核心整体执行。块之间的分支变成守卫，走向与记录时不同就从轨迹退出；
+// 回到循环头时直接从头再来，不再经过调度器和块之间的链接
+struct Trace {
+    // 记录轨迹时最多跨越的基本块数，超过时放弃
+    static constexpr size_t MAX_BLOCKS = 16;
+
+    // 轨迹中的一个基本块：first 是它第一条指令的下标，
+    // back 表示从前一个块（对循环头是最后一个块）跳过来算作回跳
+    struct Entry {
+        size_t first;
+        Block *block;
+        bool back;
+    };
+
+    uint64_t head = 0;
+    std::vector<DecodedInst> insts;
+    std::vector<uint64_t> pcs; // 每条指令的地址，守卫拿跳转目标与下一条的地址比较
+    std::vector<Entry> blocks;
+    uint64_t length = 0; // 走完一遍完成的客户机指令数
+
+    // 按离开时的位置补记各块的执行次数和回跳次数，与逐块执行时调度器的计数相同。
+    // 进入时循环头的执行次数已经由调度器记上。返回最后执行的块的入口
+    uint64_t account(const TraceExit &exit) const;
+};
+
+// 把记录下的路径（第一个块是循环头）拼接成轨迹
+std::unique_ptr<Trace> make_trace(const std::vector<Block *> &path);
+
+// 热点探测和轨迹的统计
+struct TraceStats {
+    uint64_t recorded = 0; // 成功生成的轨迹数
+    uint64_t aborted = 0;  // 放弃的记录次数
+    uint64_t entered = 0;  // 进入轨迹的次数
+    uint64_t exits = 0;    // 守卫失败，从轨迹中间退出的次数
+
+    // 打印统计信息
+    void dump() const;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include <algorithm>
+
+#include "trace_sink.hh"
+
+TraceSink::TraceSink(const std::string &path, TraceLevel level)
+    : file(std::fopen(path.c_str(), "wb")),
+      active(std::min(level, MAX_TRACE_LEVEL)) {
+    buffer.reserve(BUFFER_RECORDS);
+}
+
+TraceSink::~TraceSink() {
+    flush();
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+}
+
+void TraceSink::flush() {
+    if (file != nullptr && !buffer.empty()) {
+        std::fwrite(buffer.data(), sizeof(TraceRecord), buffer.size(), file);
+        std::fflush(file);
+    }
+    buffer.clear();
+}
+
+std::vector<TraceRecord> TraceSink::read(const std::string &path) {
+    std::vector<TraceRecord> records;
+    std::FILE *in = std::fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+        return records;
+    }
+    TraceRecord record;
+    while (std::fread(&record, sizeof(record), 1, in) == 1) {
+        records.push_back(record);
+    }
+    std::fclose(in);
+    return records;
+}
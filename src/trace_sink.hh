@@ -0,0 +1,91 @@
+#ifndef TRACE_SINK_H
+#define TRACE_SINK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// 执行日志的详细程度，数值越大记录越多
+enum class TraceLevel : uint8_t {
+    Off = 0,
+    Trap = 1,  // 只记录进入异常
+    Block = 2, // 另外记录调度器每次进入的基本块
+    Inst = 3,  // 另外记录每条完成的指令（不经过融合，逐条执行）
+};
+
+// 编译时允许的最高级别，由 CMake 选项 CRVEMU_TRACE_LEVEL 设置。
+// 高于它的记录点不会编译进来，为0时没有任何开销
+#ifndef CRVEMU_TRACE_LEVEL
+#define CRVEMU_TRACE_LEVEL 0
+#endif
+constexpr TraceLevel MAX_TRACE_LEVEL =
+    static_cast<TraceLevel>(CRVEMU_TRACE_LEVEL);
+
+// 日志中的一条定长记录，按宿主机字节序原样写入文件
+struct TraceRecord {
+    enum Kind : uint32_t {
+        Inst,  // value 是指令编码，aux 是融合前的指令条数
+        Block, // value 是基本块的结束地址（不含）
+        Trap,  // value 是 mtval，aux 是 mcause
+    };
+
+    uint64_t pc;
+    uint64_t instret; // 记录时已经完成的指令数
+    uint64_t value;
+    uint32_t kind;
+    uint32_t aux;
+};
+static_assert(sizeof(TraceRecord) == 32);
+
+// 二进制执行日志：记录先攒在内存中，满了再整块写入文件，析构时写出剩余部分。
+// 运行时挂到 Cpu::trace_sink 上才会开始记录
+class TraceSink {
+public:
+    // 缓冲的记录条数
+    static constexpr size_t BUFFER_RECORDS = 4096;
+
+    // 打开 path 用于写入，失败时 is_open() 返回 false
+    TraceSink(const std::string &path, TraceLevel level);
+    ~TraceSink();
+
+    TraceSink(const TraceSink &) = delete;
+    TraceSink &operator=(const TraceSink &) = delete;
+
+    bool is_open() const {
+        return file != nullptr;
+    }
+
+    // 运行时选择的级别，不超过 MAX_TRACE_LEVEL
+    TraceLevel level() const {
+        return active;
+    }
+
+    // 是否需要记录 level 级别的事件。编译时关闭的级别直接是常量 false
+    static constexpr bool compiled(TraceLevel level) {
+        return level != TraceLevel::Off && level <= MAX_TRACE_LEVEL;
+    }
+    bool enabled(TraceLevel level) const {
+        return compiled(level) && level <= active;
+    }
+
+    void write(const TraceRecord &record) {
+        buffer.push_back(record);
+        if (buffer.size() == BUFFER_RECORDS) {
+            flush();
+        }
+    }
+
+    // 把缓冲的记录写入文件
+    void flush();
+
+    // 读出日志文件中的全部记录
+    static std::vector<TraceRecord> read(const std::string &path);
+
+private:
+    std::FILE *file = nullptr;
+    TraceLevel active;
+    std::vector<TraceRecord> buffer;
+};
+
+#endif
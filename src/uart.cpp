@@ -0,0 +1,23 @@
+#include "uart.hh"
+
+namespace {
+
+// LSR 的 THRE 和 TEMT 位：发送保持寄存器和发送移位寄存器都为空
+constexpr uint64_t LSR_TX_IDLE = 0x60;
+
+} // namespace
+
+std::optional<uint64_t> Uart::load(uint64_t offset, uint64_t size) {
+    if (offset == LSR && size == 8) {
+        return LSR_TX_IDLE;
+    }
+    return 0;
+}
+
+bool Uart::store(uint64_t offset, uint64_t size, uint64_t value) {
+    if (offset == THR && size == 8) {
+        out.put(static_cast<char>(value));
+        out.flush();
+    }
+    return true;
+}
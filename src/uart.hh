@@ -0,0 +1,24 @@
+#ifndef UART_H
+#define UART_H
+
+#include <iostream>
+
+#include "device.hh"
+
+// 最简单的 16550 串口：只实现发送，写入 THR 的字节直接输出到 out。
+// LSR 总是报告发送缓冲为空、没有收到数据，其余寄存器读出0、写入忽略
+class Uart : public Device {
+public:
+    static constexpr uint64_t THR = 0;
+    static constexpr uint64_t LSR = 5;
+
+    explicit Uart(std::ostream &out = std::cout) : out(out) {}
+
+    std::optional<uint64_t> load(uint64_t offset, uint64_t size) override;
+    bool store(uint64_t offset, uint64_t size, uint64_t value) override;
+
+private:
+    std::ostream &out;
+};
+
+#endif